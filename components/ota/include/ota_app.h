@@ -14,6 +14,20 @@ const esp_partition_t *ota_app_get_partition();
  */
 esp_err_t ota_app_begin();
 
+/**
+ * @brief Announce the expected image size (after ota_app_begin()).
+ *
+ * Once the image header is checked, the update partition is erased in a
+ * background task, so that writes find erased sectors instead of erasing them
+ * on the critical path. Without it, sectors are erased while writing.
+ *
+ * @param size Expected image size in bytes (0 if unknown: whole partition).
+ * @return ESP_OK on success, ESP_ERR_OTA_PARTITION_CONFLICT or
+ *         ESP_ERR_OTA_ROLLBACK_INVALID_STATE if the partition can't be erased
+ *         (checks of esp_ota_begin()), or another error code (erase while writing).
+ */
+esp_err_t ota_app_prepare(size_t size);
+
 /**
  * @brief Write chunk of firmware data to flash.
  *
@@ -28,12 +42,22 @@ esp_err_t ota_app_begin();
  /**
  * @brief End the OTA firmware update.
  *
- * This function finalizes the OTA application, marking it as complete.
+ * This function finalizes and validates the written image, the boot
+ * partition is only changed by ota_app_commit().
  *
  * @return ESP_OK on success, or an error code on failure.
  */
  esp_err_t ota_app_end();
 
+ /**
+ * @brief Commit the OTA firmware update.
+ *
+ * This function sets the new image as boot partition (new firmware runs after reboot).
+ *
+ * @return ESP_OK on success, or an error code on failure.
+ */
+ esp_err_t ota_app_commit();
+
  /**
  * @brief Check if the OTA update is in progress.
  *
@@ -0,0 +1,69 @@
+#ifndef _OTA_BUNDLE_H_
+#define _OTA_BUNDLE_H_
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/**
+ * @brief Magic bytes at the start of an OTA bundle (see tools/mkotabundle.py).
+ */
+#define OTA_BUNDLE_MAGIC "AYOB"
+
+/**
+ * @brief Maximum number of images in a bundle (one per target).
+ */
+#define OTA_BUNDLE_MAX_ENTRIES 3
+
+/**
+ * @brief Pseudo partition of the bundle target (size covering all targets).
+ *
+ * @return A pointer to the bundle partition.
+ */
+const esp_partition_t *ota_bundle_get_partition();
+
+/**
+ * @brief Start receiving an OTA bundle (ESP32 app, LittleFS and/or RA4M1 images).
+ *
+ * Images are dispatched to their OTA target in sequence while streaming,
+ * each one is checked (size and SHA-256) and ended, nothing is committed
+ * before ota_bundle_commit().
+ *
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t ota_bundle_begin();
+
+/**
+ * @brief Write bundle data (streamed, any chunk size).
+ *
+ * @param data Pointer to the data to write.
+ * @param len Length of the data in bytes.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on invalid manifest,
+ *         ESP_ERR_INVALID_CRC on image hash mismatch, or the error of the image target.
+ */
+esp_err_t ota_bundle_write(char *data, size_t len);
+
+/**
+ * @brief Check that all images of the bundle were received.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if truncated.
+ */
+esp_err_t ota_bundle_end();
+
+/**
+ * @brief Commit all images of the bundle.
+ *
+ * The RA4M1 firmware is committed first, then the file system and the ESP32
+ * application. If a commit fails, all images are aborted (the file system
+ * switches back to its previous slot). The ESP32 restarts (once) when its
+ * application was updated.
+ *
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t ota_bundle_commit();
+
+/**
+ * @brief Abort the bundle update, images already written are not committed.
+ */
+void ota_bundle_abort();
+
+#endif
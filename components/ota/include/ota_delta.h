@@ -0,0 +1,71 @@
+#ifndef _OTA_DELTA_H_
+#define _OTA_DELTA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/**
+ * @brief Magic bytes at the start of a delta patch (see tools/mkdelta.py).
+ */
+#define OTA_DELTA_MAGIC "AYDP"
+
+/**
+ * @brief Size of the delta patch header in bytes.
+ */
+#define OTA_DELTA_HEADER_SIZE 76
+
+/**
+ * @brief Callback receiving the reconstructed image.
+ *
+ * @param data Pointer to image data.
+ * @param len  Length of image data in bytes.
+ * @return ESP_OK to continue, any other value aborts patching.
+ */
+typedef esp_err_t (*ota_delta_output_t)(const uint8_t *data, size_t len);
+
+/**
+ * @brief Check whether a buffer starts with the delta patch magic bytes.
+ *
+ * @param data Pointer to the first bytes of a stream.
+ * @param len  Number of bytes available.
+ * @return true if data looks like a delta patch.
+ */
+bool ota_delta_is_delta(const uint8_t *data, size_t len);
+
+/**
+ * @brief Start applying a delta patch against a base application partition.
+ *
+ * @param base   Partition holding the base image (running application).
+ * @param output Callback receiving the reconstructed image.
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t ota_delta_begin(const esp_partition_t *base, ota_delta_output_t output);
+
+/**
+ * @brief Feed patch data (streamed, any chunk size).
+ *
+ * @param data Pointer to patch data.
+ * @param len  Length of patch data in bytes.
+ * @return ESP_OK on success,
+ *         ESP_ERR_INVALID_VERSION if the patch was built against another base image,
+ *         ESP_ERR_INVALID_ARG on corrupted patch, or the error returned by the output callback.
+ */
+esp_err_t ota_delta_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Check that the patch is complete and the reconstructed image matches its SHA-256.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if truncated, ESP_ERR_INVALID_CRC on hash mismatch.
+ */
+esp_err_t ota_delta_end(void);
+
+/**
+ * @brief Abort patching and release resources.
+ */
+void ota_delta_abort(void);
+
+#endif
@@ -3,6 +3,50 @@
 
 #include "esp_err.h"
 #include "esp_http_server.h"
+#include "esp_partition.h"
+
+/**
+ * @brief HTTP header carrying the Ed25519 signature (hex) of the OTA payload SHA-256.
+ *
+ * The payload SHA-256 itself is supplied with the X-Content-SHA256 header or the
+ * sha256 query parameter (signature query parameter for the signature). Digests
+ * are computed over the data written to the target, i.e. after decompression.
+ */
+#define OTA_HDR_SIGNATURE "X-Content-Signature"
+
+/**
+ * @brief HTTP header carrying the offset to resume an interrupted upload from.
+ */
+#define OTA_HDR_OFFSET "X-OTA-Offset"
+
+/**
+ * @brief OTA target (binaryType) functions.
+ *
+ * Data is streamed with write() after begin(). The optional prepare() announces
+ * the expected size right after begin(), e.g. to erase flash ahead of the
+ * writes while the payload is still being received. end() completes and checks the
+ * written image without making it effective, which is done by commit(). abort()
+ * can be called at any time before commit() and leaves the current firmware
+ * or file system in use.
+ */
+typedef struct {
+    const char *name;                            /*!< binaryType, reported in progress messages */
+    esp_err_t (*begin)();
+    esp_err_t (*prepare)(size_t size);           /*!< Optional (NULL) */
+    esp_err_t (*write)(char *data, size_t len);
+    esp_err_t (*end)();
+    esp_err_t (*commit)();
+    void (*abort)();
+    const esp_partition_t *(*get_partition)();
+} ota_func_t;
+
+/**
+ * @brief Get an OTA target from its name.
+ *
+ * @param name binaryType (e.g. "esp32_app").
+ * @return Target functions, NULL if unknown.
+ */
+const ota_func_t *ota_handler_get_func(const char *name);
 
 /**
  * @brief Handle POST requests for OTA updates.
@@ -15,4 +59,18 @@
  */
 esp_err_t ota_post_handler(httpd_req_t *req);
 
+/**
+ * @brief Handle GET requests reporting the OTA session state.
+ *
+ * When an upload is interrupted (connection lost), the session is kept for
+ * CONFIG_OTA_RESUME_TIMEOUT seconds. This handler reports its target, offset
+ * (bytes received), total size and the SHA-256 of the data written so far,
+ * the upload is resumed by POSTing the remaining bytes with the offset query
+ * parameter (e.g. /ota?binaryType=esp32_app&offset=123456).
+ *
+ * @param req Pointer to the HTTP request structure.
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t ota_get_handler(httpd_req_t *req);
+
 #endif
\ No newline at end of file
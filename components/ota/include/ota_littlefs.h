@@ -28,12 +28,21 @@ esp_err_t ota_littlefs_write(char *data, size_t len);
 /**
  * @brief End the LITTLEFS file system update.
  *
- * This function finalizes the LITTLEFS file system update, marking it as complete.
+ * This function writes the remaining data, the file system is remounted by ota_littlefs_commit().
  *
  * @return ESP_OK on success, or an error code on failure.
  */
 esp_err_t ota_littlefs_end();
 
+/**
+ * @brief Commit the LITTLEFS file system update.
+ *
+ * This function remounts the updated file system.
+ *
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t ota_littlefs_commit();
+
 /**
  * @brief Check if the LITTLEFS update is in progress.
  *
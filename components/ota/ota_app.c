@@ -1,17 +1,45 @@
 #include <string.h>
+#include <sys/param.h>
 
 #include <esp_ota_ops.h>
 #include <esp_task_wdt.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "esp_app_format.h"
+#include "esp_image_format.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "ota_app.h"
+#include "ota_delta.h"
+
+/* Image start needed to check the new firmware version */
+#define OTA_APP_HEADER_SIZE (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t))
+
+/* Background erase (ahead of the writes) */
+#define OTA_APP_ERASE_BLOCK_SIZE      (64 * 1024)  /*!< Flash block, erased at once */
+#define OTA_APP_ERASE_TASK_STACK_SIZE 3072
+#define OTA_APP_ERASE_TASK_PRIORITY   4            /*!< Below the OTA writer task */
 
 typedef struct {
     const esp_partition_t *partition;  /*!< Pointer to the OTA partition */
     esp_ota_handle_t partition_handle; /*!< Handle for the OTA partition */
     bool image_header_checked;         /*!< Flag indicating if the image header has been checked */
     size_t binary_file_length;         /*!< Length of the binary file written so far */
+    bool is_delta;                     /*!< Payload is a delta patch against the running image */
+    bool is_validated;                 /*!< Image complete and valid, not yet committed */
+    size_t header_length;              /*!< Bytes buffered in header until the payload type is known */
+    char header[OTA_APP_HEADER_SIZE];  /*!< Start of the payload */
+    bool is_preerased;                 /*!< Partition erased by the erase task (raw partition writes, no OTA handle) */
+    size_t prepared_size;              /*!< Image size announced by ota_app_prepare() (0 if unknown) */
+    bool is_prepared;                  /*!< Background erase requested, started once the image header is checked */
+    size_t erase_end;                  /*!< End of the region erased in background */
+    volatile size_t erased_size;       /*!< Bytes erased so far (from the partition start) */
+    volatile bool erase_stop;          /*!< Request the erase task to stop */
+    volatile esp_err_t erase_err;      /*!< Erase error (erase task) */
+    SemaphoreHandle_t erase_progress;  /*!< Given by the erase task after each block */
+    SemaphoreHandle_t erase_done;      /*!< Given when the erase task exits */
 } ota_app_data_t;
 
 static const char *TAG = "ota_app";
@@ -22,10 +50,130 @@ const esp_partition_t *ota_app_get_partition() {
   return _self.partition;
 }
 
+/* Erase the partition ahead of the writes, block by block */
+static void _ota_app_erase_task(void *arg) {
+  int64_t start = esp_timer_get_time();
+  while (!_self.erase_stop && _self.erased_size < _self.erase_end) {
+    size_t len = MIN(OTA_APP_ERASE_BLOCK_SIZE, _self.erase_end - _self.erased_size);
+    esp_err_t err = esp_partition_erase_range(_self.partition, _self.erased_size, len);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Unable to erase partition @ 0x%08x (%s)", _self.erased_size, esp_err_to_name(err));
+      _self.erase_err = err;
+      break;
+    }
+    _self.erased_size += len;
+    xSemaphoreGive(_self.erase_progress);
+  }
+  ESP_LOGI(TAG, "Erased %u bytes in background (%lld ms)", _self.erased_size, (esp_timer_get_time() - start) / 1000);
+  xSemaphoreGive(_self.erase_progress);
+  xSemaphoreGive(_self.erase_done);
+  vTaskDelete(NULL);
+}
+
+/* Stop the erase task and release its resources */
+static void _ota_app_erase_stop(void) {
+  if (_self.erase_done) {
+    _self.erase_stop = true;
+    xSemaphoreTake(_self.erase_done, portMAX_DELAY);
+    vSemaphoreDelete(_self.erase_done);
+    _self.erase_done = NULL;
+  }
+  if (_self.erase_progress) {
+    vSemaphoreDelete(_self.erase_progress);
+    _self.erase_progress = NULL;
+  }
+}
+
+/* Wait until the region up to end is erased (erased on the spot beyond the background erase) */
+static esp_err_t _ota_app_wait_erased(size_t end) {
+  while (_self.erased_size < end) {
+    if (_self.erase_err != ESP_OK) {
+      return _self.erase_err;
+    }
+    if (_self.erased_size >= _self.erase_end) {
+      /* Image larger than announced (e.g. compressed payload) */
+      size_t len = MIN(OTA_APP_ERASE_BLOCK_SIZE, _self.partition->size - _self.erased_size);
+      esp_err_t err = (len > 0) ? esp_partition_erase_range(_self.partition, _self.erased_size, len) : ESP_ERR_INVALID_SIZE;
+      if (err != ESP_OK) {
+        return err;
+      }
+      _self.erased_size += len;
+    } else {
+      xSemaphoreTake(_self.erase_progress, pdMS_TO_TICKS(100));
+    }
+  }
+  return ESP_OK;
+}
+
+/* Checks done by esp_ota_begin() before erasing the partition */
+static esp_err_t _ota_app_check_partition(void) {
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  esp_ota_img_states_t ota_state;
+
+  if (_self.partition == running) {
+    return ESP_ERR_OTA_PARTITION_CONFLICT;
+  }
+  /* Running image not confirmed yet: the update partition is the rollback target */
+  if (esp_ota_get_state_partition(running, &ota_state) == ESP_OK && ota_state == ESP_OTA_IMG_PENDING_VERIFY) {
+    return ESP_ERR_OTA_ROLLBACK_INVALID_STATE;
+  }
+  return ESP_OK;
+}
+
+esp_err_t ota_app_prepare(size_t size) {
+  if (_self.partition == NULL || _self.erase_done || _self.is_prepared) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = _ota_app_check_partition();
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Partition can't be erased in background (%s)", esp_err_to_name(err));
+    return err;
+  }
+  _self.prepared_size = size;
+  _self.is_prepared = true;
+  return ESP_OK;
+}
+
+/* Start the background erase (image header checked) */
+static esp_err_t _ota_app_erase_start(void) {
+  esp_err_t err = _ota_app_check_partition();
+  if (err != ESP_OK) {
+    return err;
+  }
+  /* Size unknown: erase the whole partition (stopped once the image is complete) */
+  size_t size = _self.prepared_size;
+  size_t end = (size > 0) ? ((size + OTA_APP_ERASE_BLOCK_SIZE - 1) / OTA_APP_ERASE_BLOCK_SIZE) * OTA_APP_ERASE_BLOCK_SIZE : _self.partition->size;
+  _self.erase_end = MIN(end, _self.partition->size);
+  _self.erased_size = 0;
+  _self.erase_stop = false;
+  _self.erase_err = ESP_OK;
+  _self.erase_progress = xSemaphoreCreateBinary();
+  _self.erase_done = xSemaphoreCreateBinary();
+  if (!_self.erase_progress || !_self.erase_done ||
+      xTaskCreate(_ota_app_erase_task, "ota_erase", OTA_APP_ERASE_TASK_STACK_SIZE, NULL, OTA_APP_ERASE_TASK_PRIORITY, NULL) != pdPASS) {
+    if (_self.erase_done) {
+      vSemaphoreDelete(_self.erase_done);
+      _self.erase_done = NULL;
+    }
+    _ota_app_erase_stop();
+    return ESP_ERR_NO_MEM;
+  }
+  _self.is_preerased = true;
+  ESP_LOGI(TAG, "Erasing %u bytes in background", _self.erase_end);
+  return ESP_OK;
+}
+
 esp_err_t ota_app_begin() {
+  _ota_app_erase_stop();
+  _self.is_preerased = false;
+  _self.is_prepared = false;
+  _self.prepared_size = 0;
   _self.partition_handle = 0;
   _self.image_header_checked = false;
   _self.binary_file_length = 0;
+  _self.is_delta = false;
+  _self.is_validated = false;
+  _self.header_length = 0;
 
   _self.partition = esp_ota_get_next_update_partition(NULL);
   if (_self.partition == NULL) {
@@ -39,12 +187,13 @@ esp_err_t ota_app_begin() {
 }
 
 
-esp_err_t ota_app_write(char *data, size_t len) {
+/* Write (full) image data, the first write must contain the image header */
+static esp_err_t _ota_app_write_image(const uint8_t *data, size_t len) {
   esp_err_t err = ESP_OK;
 
   if (_self.image_header_checked == false) {
       esp_app_desc_t new_app_info;
-      if (len > sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+      if (len >= OTA_APP_HEADER_SIZE) {
           // check current version with downloading
           memcpy(&new_app_info, &data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
           ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
@@ -78,10 +227,20 @@ esp_err_t ota_app_write(char *data, size_t len) {
 
           _self.image_header_checked = true;
 
-          err = esp_ota_begin(_self.partition, OTA_WITH_SEQUENTIAL_WRITES, &_self.partition_handle);
-          if (err != ESP_OK) {
-              ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
-              return ESP_FAIL;
+          /* Pre-erased partition: written directly (esp_ota_write_with_offset() requires
+             a partition erased by esp_ota_begin()) and verified by ota_app_end() */
+          if (_self.is_prepared) {
+              _self.is_prepared = false;
+              if (_ota_app_erase_start() != ESP_OK) {
+                  ESP_LOGW(TAG, "Unable to start background erase, erasing while writing");
+              }
+          }
+          if (!_self.is_preerased) {
+              err = esp_ota_begin(_self.partition, OTA_WITH_SEQUENTIAL_WRITES, &_self.partition_handle);
+              if (err != ESP_OK) {
+                  ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
+                  return ESP_FAIL;
+              }
           }
       } else {
           ESP_LOGE(TAG, "Not enough data received to check header");
@@ -89,7 +248,15 @@ esp_err_t ota_app_write(char *data, size_t len) {
       }
   }
 
-  err = esp_ota_write( _self.partition_handle, (const void *)data, len);
+  if (_self.is_preerased) {
+    /* Sectors are erased ahead by the erase task */
+    err = _ota_app_wait_erased(_self.binary_file_length + len);
+    if (err == ESP_OK) {
+      err = esp_partition_write(_self.partition, _self.binary_file_length, data, len);
+    }
+  } else {
+    err = esp_ota_write( _self.partition_handle, (const void *)data, len);
+  }
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "esp_ota_write failed (%s)", esp_err_to_name(err));
     return ESP_FAIL;
@@ -101,26 +268,139 @@ esp_err_t ota_app_write(char *data, size_t len) {
   return err;
 }
 
+/* Image reconstructed from a delta patch, buffered until the image header is complete */
+static esp_err_t _ota_app_write_delta_output(const uint8_t *data, size_t len) {
+  if (_self.image_header_checked == false) {
+    size_t header_len = MIN(len, OTA_APP_HEADER_SIZE - _self.header_length);
+    memcpy(&_self.header[_self.header_length], data, header_len);
+    _self.header_length += header_len;
+    data += header_len;
+    len -= header_len;
+    if (_self.header_length < OTA_APP_HEADER_SIZE) {
+      return ESP_OK;
+    }
+    esp_err_t err = _ota_app_write_image((const uint8_t *) _self.header, OTA_APP_HEADER_SIZE);
+    if (err != ESP_OK || len == 0) {
+      return err;
+    }
+  }
+  return _ota_app_write_image(data, len);
+}
+
+/* Select full image or delta patch once the payload start is known */
+static esp_err_t _ota_app_write_header(void) {
+  if (ota_delta_is_delta((const uint8_t *) _self.header, _self.header_length)) {
+    ESP_LOGI(TAG, "Delta patch against running partition");
+    _self.is_delta = true;
+    esp_err_t err = ota_delta_begin(esp_ota_get_running_partition(), _ota_app_write_delta_output);
+    if (err != ESP_OK) {
+      return err;
+    }
+    /* Header buffer is reused for the reconstructed image */
+    size_t header_length = _self.header_length;
+    char header[OTA_APP_HEADER_SIZE];
+    memcpy(header, _self.header, header_length);
+    _self.header_length = 0;
+    return ota_delta_write((const uint8_t *) header, header_length);
+  }
+  return _ota_app_write_image((const uint8_t *) _self.header, _self.header_length);
+}
+
+esp_err_t ota_app_write(char *data, size_t len) {
+  if (_self.is_delta) {
+    return ota_delta_write((const uint8_t *) data, len);
+  }
+  if (_self.image_header_checked) {
+    return _ota_app_write_image((const uint8_t *) data, len);
+  }
+
+  /* Buffer the payload start (data can be delivered in small chunks, e.g. after decompression) */
+  size_t header_len = MIN(len, OTA_APP_HEADER_SIZE - _self.header_length);
+  memcpy(&_self.header[_self.header_length], data, header_len);
+  _self.header_length += header_len;
+  if (_self.header_length < OTA_APP_HEADER_SIZE) {
+    return ESP_OK;
+  }
+  esp_err_t err = _ota_app_write_header();
+  if (err != ESP_OK || len == header_len) {
+    return err;
+  }
+  return ota_app_write(data + header_len, len - header_len);
+}
+
+/* Verify an image written to the pre-erased partition (what esp_ota_end() does for OTA handles) */
+static esp_err_t _ota_app_verify_image(void) {
+  const esp_partition_pos_t part_pos = {
+    .offset = _self.partition->address,
+    .size = _self.partition->size,
+  };
+  esp_image_metadata_t data;
+
+  if (esp_image_verify(ESP_IMAGE_VERIFY, &part_pos, &data) != ESP_OK) {
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+  return ESP_OK;
+}
+
 esp_err_t ota_app_end() {
   esp_err_t err = ESP_OK;
+  /* Remaining sectors (beyond the image) don't need to be erased */
+  _ota_app_erase_stop();
+  if (!_self.is_delta && !_self.image_header_checked && _self.header_length > 0) {
+    /* Short payload, only a (small) delta patch can be valid */
+    err = ota_delta_is_delta((const uint8_t *) _self.header, _self.header_length) ? _ota_app_write_header() : ESP_ERR_INVALID_SIZE;
+  }
+  if (err == ESP_OK && _self.is_delta) {
+    err = ota_delta_end();
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Invalid image (%s)", esp_err_to_name(err));
+    ota_app_abort();
+    return err;
+  }
+  _self.is_delta = false;
   if( _self.partition_handle ) {
     err = esp_ota_end(_self.partition_handle);
     _self.partition_handle = 0;
     if (err != ESP_OK) {
       ESP_LOGE(TAG, "esp_ota_end failed (%s)", esp_err_to_name(err));
     } else {
-      err = esp_ota_set_boot_partition(_self.partition);
-      if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)", esp_err_to_name(err));
-      } else {
-        ESP_LOGI(TAG, "ESP32 OTA App update succeeded");
-      }
+      _self.is_validated = true;
+    }
+  } else if (_self.is_preerased && _self.image_header_checked) {
+    err = _ota_app_verify_image();
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Image verification failed (%s)", esp_err_to_name(err));
+    } else {
+      _self.is_validated = true;
     }
   }
   return err;
 }
 
+esp_err_t ota_app_commit() {
+  if (!_self.is_validated) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  _self.is_validated = false;
+  esp_err_t err = esp_ota_set_boot_partition(_self.partition);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)", esp_err_to_name(err));
+  } else {
+    ESP_LOGI(TAG, "ESP32 OTA App update succeeded");
+  }
+  return err;
+}
+
 void ota_app_abort() {
+  /* Image written but not committed: the boot partition is left unchanged */
+  _self.is_validated = false;
+  _self.is_prepared = false;
+  _ota_app_erase_stop();
+  if (_self.is_delta) {
+    ota_delta_abort();
+    _self.is_delta = false;
+  }
   if( _self.partition_handle ) {
     esp_ota_abort(_self.partition_handle);
     _self.partition_handle = 0;
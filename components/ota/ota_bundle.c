@@ -0,0 +1,375 @@
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+
+#include "ota_bundle.h"
+#include "ota_handler.h"
+#include "ra4m1_flash.h"
+#include "utils_gzip.h"
+#include "utils_sha256.h"
+
+/* Bundle layout (little endian), see tools/mkotabundle.py:
+ *   header : magic "AYOB", u16 version, u16 count
+ *   entries: char name[16] (binaryType), u32 size (stored), u32 image_size,
+ *            u32 flags (bit 0: gzip), u8 sha256[32] (SHA-256 of the image)
+ *   data   : images in entry order (esp32_app, esp32_littlefs, ra4m1_app)
+ */
+#define BUNDLE_VERSION        1
+#define BUNDLE_HEADER_SIZE    8
+#define BUNDLE_ENTRY_SIZE     60
+#define BUNDLE_NAME_SIZE      16
+#define BUNDLE_FLAG_GZIP      0x01
+#define BUNDLE_REBOOT_DELAY_US (2 * 1000 * 1000)  /*!< Let the HTTP response go out first */
+
+typedef enum {
+    BUNDLE_STATE_HEADER,
+    BUNDLE_STATE_ENTRIES,
+    BUNDLE_STATE_DATA,
+    BUNDLE_STATE_DONE,
+} ota_bundle_state_t;
+
+typedef struct {
+    char name[BUNDLE_NAME_SIZE + 1];
+    uint32_t size;
+    uint32_t image_size;
+    uint32_t flags;
+    uint8_t sha256[UTILS_SHA256_SIZE];
+    const ota_func_t *func;
+} ota_bundle_entry_t;
+
+typedef struct {
+    esp_partition_t partition;                        /*!< Pseudo partition (size check only) */
+    ota_bundle_state_t state;
+    uint8_t manifest[BUNDLE_HEADER_SIZE + OTA_BUNDLE_MAX_ENTRIES * BUNDLE_ENTRY_SIZE];
+    size_t manifest_size;                             /*!< Expected manifest bytes */
+    size_t offset;                                    /*!< Manifest bytes buffered */
+    ota_bundle_entry_t entries[OTA_BUNDLE_MAX_ENTRIES];
+    int count;
+    int current;                                      /*!< Image being written */
+    int ended;                                        /*!< Images written and checked */
+    bool is_started;                                  /*!< Current image target begun */
+    uint32_t remaining;                               /*!< Stored bytes left in the current image */
+    size_t image_size;                                /*!< Image bytes written to the current target */
+    utils_gzip_t *gzip;                               /*!< Decompressor (gzip image) */
+    mbedtls_sha256_context sha256_ctx;                /*!< Current image hash */
+    esp_timer_handle_t reboot_timer;
+} ota_bundle_data_t;
+
+static const char *TAG = "ota_bundle";
+
+/* Allowed targets, in bundle order */
+static const char *_targets[] = { "esp32_app", "esp32_littlefs", "ra4m1_app" };
+
+static ota_bundle_data_t _self = {
+    .partition = {
+        .size = UINT32_MAX,  /* Images are checked against their own partition */
+    },
+};
+
+static uint32_t _get_u32(const uint8_t *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static uint16_t _get_u16(const uint8_t *data) {
+    return data[0] | (data[1] << 8);
+}
+
+const esp_partition_t *ota_bundle_get_partition() {
+    return &_self.partition;
+}
+
+esp_err_t ota_bundle_begin() {
+    esp_timer_handle_t reboot_timer = _self.reboot_timer;
+    memset(&_self, 0, sizeof(_self));
+    _self.partition.size = UINT32_MAX;
+    _self.reboot_timer = reboot_timer;
+    _self.manifest_size = BUNDLE_HEADER_SIZE;
+    _self.state = BUNDLE_STATE_HEADER;
+    return ESP_OK;
+}
+
+/* Parse the manifest entries, checking targets and their order */
+static esp_err_t _ota_bundle_parse_entries(void) {
+    int last_target = -1;
+    for (int i = 0; i < _self.count; i++) {
+        const uint8_t *entry = &_self.manifest[BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE];
+        ota_bundle_entry_t *e = &_self.entries[i];
+        memcpy(e->name, entry, BUNDLE_NAME_SIZE);
+        e->name[BUNDLE_NAME_SIZE] = '\0';
+        e->size = _get_u32(&entry[16]);
+        e->image_size = _get_u32(&entry[20]);
+        e->flags = _get_u32(&entry[24]);
+        memcpy(e->sha256, &entry[28], UTILS_SHA256_SIZE);
+
+        int target = -1;
+        for (int t = 0; t < sizeof(_targets) / sizeof(_targets[0]); t++) {
+            if (!strcmp(e->name, _targets[t])) {
+                target = t;
+            }
+        }
+        if (target <= last_target) {
+            ESP_LOGE(TAG, "Invalid or misordered image '%s'", e->name);
+            return ESP_ERR_INVALID_ARG;
+        }
+        last_target = target;
+        e->func = ota_handler_get_func(e->name);
+        if (e->func == NULL) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        ESP_LOGI(TAG, "Image %d: %s (%lu bytes, %lu stored%s)", i, e->name,
+                 (unsigned long) e->image_size, (unsigned long) e->size, (e->flags & BUNDLE_FLAG_GZIP) ? ", gzip" : "");
+    }
+    return ESP_OK;
+}
+
+/* Buffer and parse the header and entries */
+static esp_err_t _ota_bundle_manifest(const uint8_t **data, size_t *len) {
+    size_t copy = MIN(*len, _self.manifest_size - _self.offset);
+    memcpy(&_self.manifest[_self.offset], *data, copy);
+    _self.offset += copy;
+    *data += copy;
+    *len -= copy;
+    if (_self.offset < _self.manifest_size) {
+        return ESP_OK;
+    }
+
+    if (_self.state == BUNDLE_STATE_HEADER) {
+        if (memcmp(_self.manifest, OTA_BUNDLE_MAGIC, 4)) {
+            ESP_LOGE(TAG, "Not an OTA bundle");
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (_get_u16(&_self.manifest[4]) != BUNDLE_VERSION) {
+            ESP_LOGE(TAG, "Unsupported bundle version %u", _get_u16(&_self.manifest[4]));
+            return ESP_ERR_INVALID_ARG;
+        }
+        _self.count = _get_u16(&_self.manifest[6]);
+        if (_self.count == 0 || _self.count > OTA_BUNDLE_MAX_ENTRIES) {
+            ESP_LOGE(TAG, "Invalid number of images (%d)", _self.count);
+            return ESP_ERR_INVALID_ARG;
+        }
+        _self.manifest_size += _self.count * BUNDLE_ENTRY_SIZE;
+        _self.state = BUNDLE_STATE_ENTRIES;
+        return ESP_OK;
+    }
+
+    esp_err_t err = _ota_bundle_parse_entries();
+    if (err == ESP_OK) {
+        _self.state = BUNDLE_STATE_DATA;
+    }
+    return err;
+}
+
+/* Write image data to the current target, hashing it on the way */
+static esp_err_t _ota_bundle_image_write(void *ctx, const uint8_t *data, size_t len) {
+    ota_bundle_entry_t *e = &_self.entries[_self.current];
+    if (_self.image_size + len > e->image_size) {
+        ESP_LOGE(TAG, "%s: image larger than announced", e->name);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    _self.image_size += len;
+    mbedtls_sha256_update(&_self.sha256_ctx, data, len);
+    return e->func->write((char *) data, len);
+}
+
+static esp_err_t _ota_bundle_image_begin(void) {
+    ota_bundle_entry_t *e = &_self.entries[_self.current];
+    ESP_LOGI(TAG, "Updating %s", e->name);
+    esp_err_t err = e->func->begin();
+    if (err != ESP_OK) {
+        return err;
+    }
+    _self.is_started = true;
+    if (e->image_size > e->func->get_partition()->size) {
+        ESP_LOGE(TAG, "%s: image too large (%lu bytes)", e->name, (unsigned long) e->image_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (e->func->prepare) {
+        e->func->prepare(e->image_size);
+    }
+    if (e->flags & BUNDLE_FLAG_GZIP) {
+        _self.gzip = utils_gzip_create(_ota_bundle_image_write, NULL);
+        if (_self.gzip == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    _self.remaining = e->size;
+    _self.image_size = 0;
+    mbedtls_sha256_init(&_self.sha256_ctx);
+    mbedtls_sha256_starts(&_self.sha256_ctx, 0);
+    return ESP_OK;
+}
+
+/* Check the complete image and end its target (without committing) */
+static esp_err_t _ota_bundle_image_end(void) {
+    ota_bundle_entry_t *e = &_self.entries[_self.current];
+    uint8_t digest[UTILS_SHA256_SIZE];
+    esp_err_t err = ESP_OK;
+
+    if (_self.gzip) {
+        err = utils_gzip_finish(_self.gzip);
+        utils_gzip_destroy(_self.gzip);
+        _self.gzip = NULL;
+    }
+    mbedtls_sha256_finish(&_self.sha256_ctx, digest);
+    mbedtls_sha256_free(&_self.sha256_ctx);
+    if (err == ESP_OK && _self.image_size != e->image_size) {
+        ESP_LOGE(TAG, "%s: truncated image (%u/%lu bytes)", e->name, _self.image_size, (unsigned long) e->image_size);
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK && memcmp(digest, e->sha256, UTILS_SHA256_SIZE)) {
+        ESP_LOGE(TAG, "%s: SHA-256 mismatch", e->name);
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err == ESP_OK) {
+        err = e->func->end();
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    _self.is_started = false;
+    _self.ended++;
+    _self.current++;
+    if (_self.current == _self.count) {
+        _self.state = BUNDLE_STATE_DONE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_bundle_write(char *buffer, size_t len) {
+    const uint8_t *data = (const uint8_t *) buffer;
+    esp_err_t err = ESP_OK;
+
+    while (len > 0 && err == ESP_OK) {
+        switch (_self.state) {
+            case BUNDLE_STATE_HEADER:
+            case BUNDLE_STATE_ENTRIES:
+                err = _ota_bundle_manifest(&data, &len);
+                break;
+            case BUNDLE_STATE_DATA:
+                if (!_self.is_started) {
+                    err = _ota_bundle_image_begin();
+                    break;
+                }
+                size_t chunk = MIN(len, _self.remaining);
+                if (_self.gzip) {
+                    err = utils_gzip_write(_self.gzip, data, chunk);
+                } else {
+                    err = _ota_bundle_image_write(NULL, data, chunk);
+                }
+                data += chunk;
+                len -= chunk;
+                _self.remaining -= chunk;
+                if (err == ESP_OK && _self.remaining == 0) {
+                    err = _ota_bundle_image_end();
+                }
+                break;
+            case BUNDLE_STATE_DONE:
+                ESP_LOGE(TAG, "Unexpected data after the last image");
+                err = ESP_ERR_INVALID_SIZE;
+                break;
+        }
+    }
+    return err;
+}
+
+esp_err_t ota_bundle_end() {
+    /* Empty image at the end of the bundle */
+    if (_self.state == BUNDLE_STATE_DATA && _self.entries[_self.current].size == 0) {
+        esp_err_t err = _self.is_started ? ESP_OK : _ota_bundle_image_begin();
+        if (err == ESP_OK) {
+            err = _ota_bundle_image_end();
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    if (_self.state != BUNDLE_STATE_DONE) {
+        ESP_LOGE(TAG, "Truncated bundle (%d/%d images)", _self.ended, _self.count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+static void _ota_bundle_reboot(void *arg) {
+    ESP_LOGI(TAG, "Restarting with the new firmware");
+    esp_restart();
+}
+
+esp_err_t ota_bundle_commit() {
+    esp_err_t err = ESP_OK;
+    bool has_app = false;
+    bool has_ra4m1 = false;
+    int i;
+
+    for (i = 0; i < _self.ended; i++) {
+        has_ra4m1 |= !strcmp(_self.entries[i].name, _targets[2]);
+    }
+    if (has_ra4m1) {
+        /* RA4M1 commits first, its previous image is kept until the whole bundle is committed */
+        ra4m1_flash_hold_backup();
+    }
+
+    /* Last image first: RA4M1 (most likely to fail) before the file system and the app */
+    for (i = _self.ended - 1; i >= 0 && err == ESP_OK; i--) {
+        ota_bundle_entry_t *e = &_self.entries[i];
+        err = e->func->commit();
+        if (err == ESP_OK) {
+            has_app |= !strcmp(e->name, _targets[0]);
+        } else {
+            ESP_LOGE(TAG, "%s: commit failed (%s), rolling back", e->name, esp_err_to_name(err));
+        }
+    }
+    if (err != ESP_OK) {
+        /* Abort all images, committed ones are rolled back when possible (file system slot, RA4M1 backup) */
+        for (i = _self.ended - 1; i >= 0; i--) {
+            _self.entries[i].func->abort();
+        }
+    }
+    if (has_ra4m1) {
+        ra4m1_flash_release_backup(err == ESP_OK);
+    }
+    _self.ended = 0;
+    _self.count = 0;
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGI(TAG, "OTA bundle update succeeded");
+
+    if (has_app) {
+        /* Single reboot for the whole bundle */
+        if (_self.reboot_timer == NULL) {
+            esp_timer_create_args_t timer_args = {
+                .callback = _ota_bundle_reboot,
+                .name = "ota_bundle_reboot",
+            };
+            esp_timer_create(&timer_args, &_self.reboot_timer);
+        }
+        if (_self.reboot_timer == NULL || esp_timer_start_once(_self.reboot_timer, BUNDLE_REBOOT_DELAY_US) != ESP_OK) {
+            ESP_LOGW(TAG, "Unable to schedule restart, new firmware runs after the next reset");
+        }
+    }
+    return ESP_OK;
+}
+
+void ota_bundle_abort() {
+    if (_self.gzip) {
+        utils_gzip_destroy(_self.gzip);
+        _self.gzip = NULL;
+    }
+    if (_self.is_started) {
+        mbedtls_sha256_free(&_self.sha256_ctx);
+        _self.entries[_self.current].func->abort();
+        _self.is_started = false;
+    }
+    /* Images already ended are rolled back (not committed) */
+    for (int i = _self.ended - 1; i >= 0; i--) {
+        _self.entries[i].func->abort();
+    }
+    _self.ended = 0;
+    _self.count = 0;
+    ESP_LOGI(TAG, "OTA bundle update aborted");
+}
@@ -0,0 +1,245 @@
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_app_desc.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "ota_delta.h"
+
+/* Patch layout (little endian), see tools/mkdelta.py:
+ *   header: magic "AYDP", u32 version, u8 base_sha256[32] (app_elf_sha256 of the base),
+ *           u8 target_sha256[32] (SHA-256 of the whole target image), u32 target_size
+ *   ops   : COPY   (0x01) u32 base_offset, u32 len
+ *           ADD    (0x02) u32 base_offset, u32 len, u8 diff[len]  (target = base + diff)
+ *           INSERT (0x03) u32 len, u8 data[len]
+ *           END    (0x00)
+ */
+#define DELTA_VERSION     1
+#define DELTA_OP_END      0x00
+#define DELTA_OP_COPY     0x01
+#define DELTA_OP_ADD      0x02
+#define DELTA_OP_INSERT   0x03
+#define DELTA_BUFFER_SIZE 1024
+#define DELTA_SHA256_SIZE 32
+
+typedef enum {
+    DELTA_STATE_HEADER,
+    DELTA_STATE_OP,
+    DELTA_STATE_ARGS,
+    DELTA_STATE_DATA,
+    DELTA_STATE_DONE,
+} ota_delta_state_t;
+
+typedef struct {
+    const esp_partition_t *base;        /*!< Base (running) application partition */
+    ota_delta_output_t output;          /*!< Reconstructed image output */
+    ota_delta_state_t state;
+    uint8_t header[OTA_DELTA_HEADER_SIZE];
+    uint8_t op;                         /*!< Current operation */
+    uint8_t args[8];                    /*!< Current operation arguments */
+    size_t args_len;                    /*!< Expected arguments length */
+    size_t offset;                      /*!< Bytes buffered in header/args */
+    uint32_t base_offset;               /*!< Current base offset (COPY/ADD) */
+    uint32_t remaining;                 /*!< Bytes left in the current operation */
+    uint32_t target_size;               /*!< Expected image size */
+    size_t output_size;                 /*!< Image bytes produced so far */
+    mbedtls_sha256_context sha256_ctx;  /*!< Image hash */
+    uint8_t buffer[DELTA_BUFFER_SIZE];  /*!< Base data */
+} ota_delta_data_t;
+
+static const char *TAG = "ota_delta";
+
+static ota_delta_data_t _self;
+
+static uint32_t _get_u32(const uint8_t *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static esp_err_t _output(const uint8_t *data, size_t len) {
+    if (_self.output_size + len > _self.target_size) {
+        ESP_LOGE(TAG, "Image larger than announced (%lu bytes)", (unsigned long) _self.target_size);
+        return ESP_ERR_INVALID_ARG;
+    }
+    mbedtls_sha256_update(&_self.sha256_ctx, data, len);
+    _self.output_size += len;
+    return _self.output(data, len);
+}
+
+static esp_err_t _read_base(size_t len) {
+    if (_self.base_offset + len > _self.base->size) {
+        ESP_LOGE(TAG, "Base offset out of range (0x%08lx)", (unsigned long) _self.base_offset);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_partition_read(_self.base, _self.base_offset, _self.buffer, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to read base image (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t _check_header(void) {
+    if (_get_u32(&_self.header[4]) != DELTA_VERSION) {
+        ESP_LOGE(TAG, "Unsupported patch version %lu", (unsigned long) _get_u32(&_self.header[4]));
+        return ESP_ERR_INVALID_ARG;
+    }
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+    if (memcmp(&_self.header[8], app_desc->app_elf_sha256, DELTA_SHA256_SIZE)) {
+        ESP_LOGE(TAG, "Patch built against another base image, full image required");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    _self.target_size = _get_u32(&_self.header[8 + 2 * DELTA_SHA256_SIZE]);
+    ESP_LOGI(TAG, "Applying patch against running image (target %lu bytes)", (unsigned long) _self.target_size);
+    return ESP_OK;
+}
+
+/* Decode operation arguments once complete */
+static esp_err_t _start_op(void) {
+    switch (_self.op) {
+        case DELTA_OP_COPY:
+        case DELTA_OP_ADD:
+            _self.base_offset = _get_u32(&_self.args[0]);
+            _self.remaining = _get_u32(&_self.args[4]);
+            break;
+        case DELTA_OP_INSERT:
+            _self.remaining = _get_u32(&_self.args[0]);
+            break;
+    }
+    if (_self.op != DELTA_OP_COPY) {
+        _self.state = (_self.remaining > 0) ? DELTA_STATE_DATA : DELTA_STATE_OP;
+        return ESP_OK;
+    }
+
+    /* COPY doesn't consume patch data */
+    while (_self.remaining > 0) {
+        size_t len = MIN(_self.remaining, DELTA_BUFFER_SIZE);
+        esp_err_t err = _read_base(len);
+        if (err == ESP_OK) {
+            err = _output(_self.buffer, len);
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+        _self.base_offset += len;
+        _self.remaining -= len;
+    }
+    _self.state = DELTA_STATE_OP;
+    return ESP_OK;
+}
+
+/* Consume data of ADD/INSERT operations (number of bytes consumed returned in consumed) */
+static esp_err_t _write_data(const uint8_t *data, size_t len, size_t *consumed) {
+    esp_err_t err;
+    len = MIN(len, _self.remaining);
+    if (_self.op == DELTA_OP_INSERT) {
+        err = _output(data, len);
+    } else {
+        len = MIN(len, DELTA_BUFFER_SIZE);
+        err = _read_base(len);
+        if (err == ESP_OK) {
+            for (size_t i = 0; i < len; i++) {
+                _self.buffer[i] += data[i];
+            }
+            err = _output(_self.buffer, len);
+        }
+        _self.base_offset += len;
+    }
+    _self.remaining -= len;
+    if (_self.remaining == 0) {
+        _self.state = DELTA_STATE_OP;
+    }
+    *consumed = len;
+    return err;
+}
+
+bool ota_delta_is_delta(const uint8_t *data, size_t len) {
+    return (len >= sizeof(OTA_DELTA_MAGIC) - 1) && !memcmp(data, OTA_DELTA_MAGIC, sizeof(OTA_DELTA_MAGIC) - 1);
+}
+
+esp_err_t ota_delta_begin(const esp_partition_t *base, ota_delta_output_t output) {
+    memset(&_self, 0, sizeof(_self));
+    if (base == NULL || output == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    _self.base = base;
+    _self.output = output;
+    _self.state = DELTA_STATE_HEADER;
+    mbedtls_sha256_init(&_self.sha256_ctx);
+    mbedtls_sha256_starts(&_self.sha256_ctx, 0);
+    return ESP_OK;
+}
+
+esp_err_t ota_delta_write(const uint8_t *data, size_t len) {
+    esp_err_t err = ESP_OK;
+    while (len > 0 && err == ESP_OK) {
+        size_t consumed = 0;
+        switch (_self.state) {
+            case DELTA_STATE_HEADER:
+                consumed = MIN(len, OTA_DELTA_HEADER_SIZE - _self.offset);
+                memcpy(&_self.header[_self.offset], data, consumed);
+                _self.offset += consumed;
+                if (_self.offset == OTA_DELTA_HEADER_SIZE) {
+                    err = ota_delta_is_delta(_self.header, OTA_DELTA_HEADER_SIZE) ? _check_header() : ESP_ERR_INVALID_ARG;
+                    _self.state = DELTA_STATE_OP;
+                }
+                break;
+            case DELTA_STATE_OP:
+                _self.op = data[0];
+                _self.offset = 0;
+                consumed = 1;
+                if (_self.op == DELTA_OP_END) {
+                    _self.state = DELTA_STATE_DONE;
+                } else if (_self.op == DELTA_OP_COPY || _self.op == DELTA_OP_ADD) {
+                    _self.args_len = 8;
+                    _self.state = DELTA_STATE_ARGS;
+                } else if (_self.op == DELTA_OP_INSERT) {
+                    _self.args_len = 4;
+                    _self.state = DELTA_STATE_ARGS;
+                } else {
+                    ESP_LOGE(TAG, "Invalid patch operation 0x%02x", _self.op);
+                    err = ESP_ERR_INVALID_ARG;
+                }
+                break;
+            case DELTA_STATE_ARGS:
+                consumed = MIN(len, _self.args_len - _self.offset);
+                memcpy(&_self.args[_self.offset], data, consumed);
+                _self.offset += consumed;
+                if (_self.offset == _self.args_len) {
+                    err = _start_op();
+                }
+                break;
+            case DELTA_STATE_DATA:
+                err = _write_data(data, len, &consumed);
+                break;
+            case DELTA_STATE_DONE:
+                ESP_LOGE(TAG, "Unexpected data after end of patch");
+                err = ESP_ERR_INVALID_ARG;
+                break;
+        }
+        data += consumed;
+        len -= consumed;
+    }
+    return err;
+}
+
+esp_err_t ota_delta_end(void) {
+    uint8_t digest[DELTA_SHA256_SIZE];
+    mbedtls_sha256_finish(&_self.sha256_ctx, digest);
+    mbedtls_sha256_free(&_self.sha256_ctx);
+
+    if (_self.state != DELTA_STATE_DONE || _self.output_size != _self.target_size) {
+        ESP_LOGE(TAG, "Incomplete patch (%u/%lu bytes)", _self.output_size, (unsigned long) _self.target_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (memcmp(digest, &_self.header[8 + DELTA_SHA256_SIZE], DELTA_SHA256_SIZE)) {
+        ESP_LOGE(TAG, "Patched image SHA-256 mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+    ESP_LOGI(TAG, "Patch applied (%u bytes)", _self.output_size);
+    return ESP_OK;
+}
+
+void ota_delta_abort(void) {
+    mbedtls_sha256_free(&_self.sha256_ctx);
+    ESP_LOGI(TAG, "Patch aborted");
+}
@@ -1,119 +1,651 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/param.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_partition.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+#include "mbedtls/sha256.h"
+#ifdef CONFIG_OTA_SIGNATURE_VERIFY
+#include "sodium.h"
+#endif
 
 #include "ota_handler.h"
 #include "ota_app.h"
+#include "ota_bundle.h"
 #include "ota_littlefs.h"
 #include "ra4m1_flash.h"
+#include "srv_file.h"
+#include "srv_progress.h"
+#include "utils_gzip.h"
+#include "utils_sha256.h"
 
 #define OTA_ESP32_APP      0
 #define OTA_ESP32_LITTLEFS 1
 #define OTA_RA4M1_FIRMWARE 2
+#define OTA_BUNDLE         3
 #define OTA_BUFFER_SIZE 8192
+#define OTA_BUFFER_COUNT 3      /*!< Buffers shared by the receiving handler and the writer task */
 
+#define OTA_RECV_TIMEOUT_RETRIES 3  /*!< Consecutive receive timeouts before the connection is considered lost */
+
+#define OTA_WRITER_TASK_STACK_SIZE 8192
+#define OTA_WRITER_TASK_PRIORITY   5
+
+#define OTA_COMPRESSION_AUTO 0  /*!< Detected from the payload magic bytes */
+#define OTA_COMPRESSION_NONE 1
+#define OTA_COMPRESSION_GZIP 2
+
+#define OTA_SIGNATURE_SIZE  64  /*!< Ed25519 signature */
+#define OTA_PUBLIC_KEY_SIZE 32  /*!< Ed25519 public key */
+
+typedef struct {
+    char *data;
+    size_t len;
+} ota_buffer_t;
+
+/* Receive/write pipeline: the httpd handler fills buffers taken from free_queue
+   and posts them to filled_queue, the writer task drains them to the OTA target
+   and gives them back (NULL buffer = end of stream).
+   The session (target, decompressor, digest, offset) outlives a lost connection
+   for CONFIG_OTA_RESUME_TIMEOUT seconds so that the upload can be resumed */
 typedef struct {
-    esp_err_t (*begin)();
-    esp_err_t (*write)(char *data, size_t len);
-    esp_err_t (*end)();
-    void (*abort)();
-    const esp_partition_t *(*get_partition)();
-} ota_func_t;
+    bool is_active;                           /*!< Session started and not completed/aborted */
+    int ota_type;                             /*!< OTA_xxx target */
+    size_t total;                             /*!< Payload size (bytes) */
+    httpd_handle_t server;                    /*!< Server running the session */
+    esp_timer_handle_t timer;                 /*!< Expiry of a suspended session */
+    ota_func_t func;                          /*!< OTA target */
+    int compression;                          /*!< OTA_COMPRESSION_xxx */
+    utils_gzip_t *gzip;                       /*!< Decompressor (gzip payload) */
+    mbedtls_sha256_context sha256_ctx;        /*!< Digest of the data written to the target */
+    bool has_digest;                          /*!< Expected digest supplied */
+    uint8_t digest[UTILS_SHA256_SIZE];        /*!< Expected digest */
+    bool has_signature;                       /*!< Signature supplied */
+    uint8_t signature[OTA_SIGNATURE_SIZE];    /*!< Ed25519 signature of the digest */
+    ota_buffer_t buffers[OTA_BUFFER_COUNT];
+    QueueHandle_t free_queue;                 /*!< Buffers available for receiving */
+    QueueHandle_t filled_queue;               /*!< Buffers waiting to be written */
+    SemaphoreHandle_t writer_done;            /*!< Given when the writer task exits */
+    volatile esp_err_t write_err;             /*!< First write error (writer task) */
+    size_t received;                          /*!< Bytes received, i.e. offset to resume from */
+    size_t written;                           /*!< Bytes handed to the OTA target (before decompression) */
+    int64_t recv_time;                        /*!< Time spent in httpd_req_recv (us) */
+    int64_t recv_wait_time;                   /*!< Time spent waiting for a free buffer, i.e. flash bound (us) */
+    int64_t write_time;                       /*!< Time spent writing (us) */
+    int64_t write_wait_time;                  /*!< Time spent waiting for received data, i.e. network bound (us) */
+} ota_handler_data_t;
 
 static const char *TAG = "ota_handler";
 
+static ota_handler_data_t _self;
+
 static ota_func_t ota_types[] = {
-    { .begin = ota_app_begin,     .write = ota_app_write,     .end = ota_app_end,     .abort = ota_app_abort,      .get_partition = ota_app_get_partition},
-    { .begin = ota_littlefs_begin,.write = ota_littlefs_write,.end = ota_littlefs_end,.abort = ota_littlefs_abort, .get_partition = ota_littlefs_get_partition},
-    { .begin = ra4m1_flash_begin, .write = ra4m1_flash_write, .end = ra4m1_flash_end, .abort = ra4m1_flash_abort , .get_partition = ra4m1_flash_get_partition},
+    [OTA_ESP32_APP]      = { .name = "esp32_app",      .begin = ota_app_begin,     .prepare = ota_app_prepare, .write = ota_app_write,     .end = ota_app_end,     .commit = ota_app_commit,     .abort = ota_app_abort,      .get_partition = ota_app_get_partition},
+    [OTA_ESP32_LITTLEFS] = { .name = "esp32_littlefs", .begin = ota_littlefs_begin,.write = ota_littlefs_write,.end = ota_littlefs_end,.commit = ota_littlefs_commit,.abort = ota_littlefs_abort, .get_partition = ota_littlefs_get_partition},
+    [OTA_RA4M1_FIRMWARE] = { .name = "ra4m1_app",      .begin = ra4m1_flash_begin, .write = ra4m1_flash_write, .end = ra4m1_flash_end, .commit = ra4m1_flash_commit, .abort = ra4m1_flash_abort , .get_partition = ra4m1_flash_get_partition},
+    [OTA_BUNDLE]         = { .name = "bundle",         .begin = ota_bundle_begin,  .write = ota_bundle_write,  .end = ota_bundle_end,  .commit = ota_bundle_commit,  .abort = ota_bundle_abort,   .get_partition = ota_bundle_get_partition},
 };
 
+/* Get the OTA target from its name (binaryType), -1 if unknown */
+static int _ota_get_type(const char *name) {
+    for (int i = 0; i < sizeof(ota_types) / sizeof(ota_func_t); i++) {
+        if (!strcmp(ota_types[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const ota_func_t *ota_handler_get_func(const char *name) {
+    int ota_type = _ota_get_type(name);
+    return (ota_type < 0) ? NULL : &ota_types[ota_type];
+}
+
+/* Parse a hexadecimal string of exactly 2 * len characters */
+static esp_err_t _hex_decode(const char *hex, uint8_t *data, size_t len) {
+    if (strlen(hex) != 2 * len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char) hex[2 * i]) || !isxdigit((unsigned char) hex[2 * i + 1]) ||
+            sscanf(&hex[2 * i], "%2x", &byte) != 1) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        data[i] = byte;
+    }
+    return ESP_OK;
+}
+
+/* Get the expected digest and signature from the query string or request headers */
+static esp_err_t _ota_get_verification(httpd_req_t *req, const char *query) {
+    char value[2 * OTA_SIGNATURE_SIZE + 1];
+
+    if ((query && httpd_query_key_value(query, "sha256", value, sizeof(value)) == ESP_OK) ||
+        httpd_req_get_hdr_value_str(req, SRV_FILE_HDR_SHA256, value, sizeof(value)) == ESP_OK) {
+        if (utils_sha256_from_hex(value, _self.digest) != ESP_OK) {
+            ESP_LOGE(TAG, "Invalid SHA-256 digest");
+            return ESP_ERR_INVALID_ARG;
+        }
+        _self.has_digest = true;
+    }
+    if ((query && httpd_query_key_value(query, "signature", value, sizeof(value)) == ESP_OK) ||
+        httpd_req_get_hdr_value_str(req, OTA_HDR_SIGNATURE, value, sizeof(value)) == ESP_OK) {
+        if (_hex_decode(value, _self.signature, OTA_SIGNATURE_SIZE) != ESP_OK) {
+            ESP_LOGE(TAG, "Invalid signature");
+            return ESP_ERR_INVALID_ARG;
+        }
+        _self.has_signature = true;
+    }
+    return ESP_OK;
+}
+
+/* Check the digest (and signature) of the data written, before the target commits it */
+static esp_err_t _ota_verify(uint8_t *digest) {
+    mbedtls_sha256_finish(&_self.sha256_ctx, digest);
+
+    if (_self.has_digest && memcmp(digest, _self.digest, UTILS_SHA256_SIZE)) {
+        ESP_LOGE(TAG, "SHA-256 mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+#ifdef CONFIG_OTA_SIGNATURE_VERIFY
+    uint8_t public_key[OTA_PUBLIC_KEY_SIZE];
+    if (_hex_decode(CONFIG_OTA_SIGNATURE_PUBLIC_KEY, public_key, sizeof(public_key)) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid OTA public key (CONFIG_OTA_SIGNATURE_PUBLIC_KEY)");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!_self.has_signature) {
+        ESP_LOGE(TAG, "Missing signature");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (sodium_init() < 0 ||
+        crypto_sign_ed25519_verify_detached(_self.signature, digest, UTILS_SHA256_SIZE, public_key) != 0) {
+        ESP_LOGE(TAG, "Invalid signature");
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_LOGI(TAG, "Signature verified");
+#endif
+    if (!_self.has_digest) {
+        ESP_LOGW(TAG, "No SHA-256 supplied, payload integrity not verified");
+    }
+    return ESP_OK;
+}
+
+/* Write data to the OTA target, hashing it on the way */
+static esp_err_t _ota_target_write(const uint8_t *data, size_t len) {
+    mbedtls_sha256_update(&_self.sha256_ctx, data, len);
+    return _self.func.write((char *) data, len);
+}
+
+/* Feed decompressed data to the OTA target */
+static esp_err_t _ota_gzip_output(void *ctx, const uint8_t *data, size_t len) {
+    return _ota_target_write(data, len);
+}
+
+/* Write a received buffer to the OTA target (writer task) */
+static esp_err_t _ota_write(ota_buffer_t *buffer) {
+    if (_self.compression == OTA_COMPRESSION_AUTO) {
+        _self.compression = utils_gzip_is_gzip((uint8_t *) buffer->data, buffer->len) ? OTA_COMPRESSION_GZIP : OTA_COMPRESSION_NONE;
+    }
+    if (_self.compression == OTA_COMPRESSION_GZIP && _self.gzip == NULL) {
+        ESP_LOGI(TAG, "Decompressing gzip payload");
+        _self.gzip = utils_gzip_create(_ota_gzip_output, NULL);
+        if (_self.gzip == NULL) {
+            ESP_LOGE(TAG, "Unable to allocate gzip decompressor");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (_self.gzip) {
+        return utils_gzip_write(_self.gzip, (uint8_t *) buffer->data, buffer->len);
+    }
+    return _ota_target_write((uint8_t *) buffer->data, buffer->len);
+}
+
+static void _ota_writer_task(void *arg) {
+    ota_buffer_t *buffer;
+    int64_t start = esp_timer_get_time();
+    while (xQueueReceive(_self.filled_queue, &buffer, portMAX_DELAY) == pdTRUE && buffer != NULL) {
+        int64_t now = esp_timer_get_time();
+        _self.write_wait_time += now - start;
+        /* Keep draining after an error so that the handler never blocks */
+        if (_self.write_err == ESP_OK) {
+            _self.write_err = _ota_write(buffer);
+            _self.written += buffer->len;
+        }
+        start = esp_timer_get_time();
+        _self.write_time += start - now;
+        xQueueSend(_self.free_queue, &buffer, portMAX_DELAY);
+    }
+    xSemaphoreGive(_self.writer_done);
+    vTaskDelete(NULL);
+}
+
+static void _ota_pipeline_free(void) {
+    for (int i = 0; i < OTA_BUFFER_COUNT; i++) {
+        free(_self.buffers[i].data);
+        _self.buffers[i].data = NULL;
+    }
+    if (_self.free_queue) {
+        vQueueDelete(_self.free_queue);
+        _self.free_queue = NULL;
+    }
+    if (_self.filled_queue) {
+        vQueueDelete(_self.filled_queue);
+        _self.filled_queue = NULL;
+    }
+    if (_self.writer_done) {
+        vSemaphoreDelete(_self.writer_done);
+        _self.writer_done = NULL;
+    }
+}
+
+/* Allocate buffers and start the writer task */
+static esp_err_t _ota_pipeline_start(void) {
+    _self.free_queue = xQueueCreate(OTA_BUFFER_COUNT, sizeof(ota_buffer_t *));
+    _self.filled_queue = xQueueCreate(OTA_BUFFER_COUNT + 1, sizeof(ota_buffer_t *));
+    _self.writer_done = xSemaphoreCreateBinary();
+    if (!_self.free_queue || !_self.filled_queue || !_self.writer_done) {
+        _ota_pipeline_free();
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < OTA_BUFFER_COUNT; i++) {
+        _self.buffers[i].data = malloc(OTA_BUFFER_SIZE);
+        if (_self.buffers[i].data == NULL) {
+            ESP_LOGE(TAG, "Unable to allocate OTA buffer (%d bytes)", OTA_BUFFER_SIZE);
+            _ota_pipeline_free();
+            return ESP_ERR_NO_MEM;
+        }
+        ota_buffer_t *buffer = &_self.buffers[i];
+        xQueueSend(_self.free_queue, &buffer, 0);
+    }
+    if (xTaskCreate(_ota_writer_task, "ota_writer", OTA_WRITER_TASK_STACK_SIZE, NULL, OTA_WRITER_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Unable to create OTA writer task");
+        _ota_pipeline_free();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* Wait for pending writes and release the pipeline, then check the
+   compressed stream is complete (unless the upload is to be resumed) */
+static esp_err_t _ota_pipeline_stop(bool is_complete) {
+    ota_buffer_t *end = NULL;
+    xQueueSend(_self.filled_queue, &end, portMAX_DELAY);
+    xSemaphoreTake(_self.writer_done, portMAX_DELAY);
+
+    esp_err_t err = _self.write_err;
+    if (err == ESP_OK && is_complete && _self.gzip) {
+        /* Make sure the whole compressed stream was received and is valid */
+        err = utils_gzip_finish(_self.gzip);
+        ESP_LOGI(TAG, "Decompressed %u bytes into %u bytes", _self.written, utils_gzip_output_size(_self.gzip));
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Invalid compressed payload (%s)", esp_err_to_name(err));
+        }
+    }
+    _ota_pipeline_free();
+    return err;
+}
+
+/* End the session, aborting the target update unless it completed */
+static void _ota_session_end(bool abort) {
+    if (_self.timer) {
+        esp_timer_stop(_self.timer);
+    }
+    if (abort) {
+        _self.func.abort();
+    }
+    mbedtls_sha256_free(&_self.sha256_ctx);
+    utils_gzip_destroy(_self.gzip);
+    _self.gzip = NULL;
+    _self.is_active = false;
+}
+
+/* Abort a suspended session which was not resumed in time (httpd task) */
+static void _ota_session_expire(void *arg) {
+    /* Ignore if resumed (and possibly suspended again) or completed meanwhile */
+    if (_self.is_active && !esp_timer_is_active(_self.timer)) {
+        ESP_LOGW(TAG, "OTA session not resumed, aborting (%u/%u bytes received)", _self.received, _self.total);
+        _ota_session_end(true);
+        srv_progress_end(ESP_ERR_TIMEOUT);
+    }
+}
+
+static void _ota_session_timeout(void *arg) {
+    /* Serialize with the handlers */
+    httpd_queue_work(_self.server, _ota_session_expire, NULL);
+}
+
+/* Keep the session after a connection loss, until resumed or timed out */
+static esp_err_t _ota_session_suspend(void) {
+    esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+    if (CONFIG_OTA_RESUME_TIMEOUT > 0 && _self.timer == NULL) {
+        esp_timer_create_args_t timer_args = {
+            .callback = _ota_session_timeout,
+            .name = "ota_session",
+        };
+        esp_timer_create(&timer_args, &_self.timer);
+    }
+    if (_self.timer) {
+        err = esp_timer_start_once(_self.timer, (uint64_t) CONFIG_OTA_RESUME_TIMEOUT * 1000000);
+    }
+    if (err != ESP_OK) {
+        _ota_session_end(true);
+        srv_progress_end(ESP_FAIL);
+        return err;
+    }
+    ESP_LOGW(TAG, "OTA session suspended at %u/%u bytes, resume within %d s", _self.received, _self.total, CONFIG_OTA_RESUME_TIMEOUT);
+    srv_progress_update(SRV_PROGRESS_STAGE_PAUSED, _self.received, _self.written);
+    return ESP_OK;
+}
+
+/* Log per-stage throughput to show whether network or flash is the bottleneck */
+static void _ota_log_stats(void) {
+    ESP_LOGI(TAG, "Receive: %u bytes in %lld ms (%lld KB/s), waited %lld ms for writer",
+             _self.received, _self.recv_time / 1000,
+             _self.recv_time ? ((int64_t) _self.received * 1000000 / 1024) / _self.recv_time : 0,
+             _self.recv_wait_time / 1000);
+    ESP_LOGI(TAG, "Write: %u bytes in %lld ms (%lld KB/s), waited %lld ms for network",
+             _self.written, _self.write_time / 1000,
+             _self.write_time ? ((int64_t) _self.written * 1000000 / 1024) / _self.write_time : 0,
+             _self.write_wait_time / 1000);
+}
+
+/* Receive a buffer (filled up to OTA_BUFFER_SIZE or remaining bytes) */
+static int _ota_receive(httpd_req_t *req, ota_buffer_t *buffer, size_t remaining) {
+    size_t len = MIN(remaining, OTA_BUFFER_SIZE);
+    int timeouts = 0;
+    buffer->len = 0;
+    while (buffer->len < len) {
+        int64_t start = esp_timer_get_time();
+        int received = httpd_req_recv(req, buffer->data + buffer->len, len - buffer->len);
+        _self.recv_time += esp_timer_get_time() - start;
+        if (received <= 0) {
+            if (received == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < OTA_RECV_TIMEOUT_RETRIES) {
+                /* Retry if timeout occurred */
+                continue;
+            }
+            return received;
+        }
+        timeouts = 0;
+        buffer->len += received;
+    }
+    return buffer->len;
+}
+
+/* Report a target write error */
+static void _send_write_error(httpd_req_t *req, esp_err_t err) {
+    if (err == ESP_ERR_INVALID_VERSION) {
+        /* Delta patch built against another base image */
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "Delta patch does not match the running firmware, full image required");
+        return;
+    }
+    if (utils_gzip_get_error(_self.gzip) != ESP_OK) {
+        /* Corrupted or truncated compressed payload (target errors are reported below) */
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid compressed payload");
+        return;
+    }
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA update failed");
+}
+
+/* Start a new session (any suspended session is discarded) */
+static esp_err_t _ota_session_begin(httpd_req_t *req, int ota_type, int compression, const char *query) {
+    if (_self.is_active) {
+        ESP_LOGW(TAG, "Discarding suspended OTA session");
+        _ota_session_end(true);
+        srv_progress_end(ESP_ERR_INVALID_STATE);
+    }
+    esp_timer_handle_t timer = _self.timer;
+    memset(&_self, 0, sizeof(_self));
+    _self.timer = timer;
+
+    if (_ota_get_verification(req, query) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid sha256 or signature");
+        return ESP_FAIL;
+    }
+
+    _self.ota_type = ota_type;
+    _self.func = ota_types[ota_type];
+    _self.compression = compression;
+    _self.total = req->content_len;
+    _self.server = req->handle;
+
+    esp_err_t err = _self.func.begin();
+    if (err != ESP_OK) {
+        /* No progress reported: the target may be busy with another operation reporting its own */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to begin OTA update");
+        return ESP_FAIL;
+    }
+    srv_progress_begin(_self.func.name, _self.total);
+
+    /* File cannot be larger than the  partition size */
+    if (req->content_len > _self.func.get_partition()->size) {
+        ESP_LOGE(TAG, "OTA Binary too large : %d bytes", req->content_len);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Binary too large !");
+        _self.func.abort();
+        srv_progress_end(ESP_ERR_INVALID_SIZE);
+        return ESP_FAIL;
+    }
+
+    /* Let the target get ready (e.g. erase flash) while the payload is received,
+       the data size is only known for uncompressed payloads */
+    if (_self.func.prepare) {
+        _self.func.prepare((compression == OTA_COMPRESSION_NONE) ? req->content_len : 0);
+    }
+
+    mbedtls_sha256_init(&_self.sha256_ctx);
+    mbedtls_sha256_starts(&_self.sha256_ctx, 0);
+    _self.is_active = true;
+    return ESP_OK;
+}
+
+/* Resume a suspended session from the given offset */
+static esp_err_t _ota_session_resume(httpd_req_t *req, int ota_type, size_t offset) {
+    if (!_self.is_active || ota_type != _self.ota_type) {
+        ESP_LOGE(TAG, "No OTA session to resume");
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "No OTA session to resume, restart the upload");
+        return ESP_FAIL;
+    }
+    if (offset != _self.received || offset + req->content_len != _self.total) {
+        ESP_LOGE(TAG, "Invalid resume range (offset=%u, length=%d, expected offset=%u, total=%u)",
+                 offset, req->content_len, _self.received, _self.total);
+        char offset_str[16];
+        snprintf(offset_str, sizeof(offset_str), "%u", _self.received);
+        httpd_resp_set_hdr(req, OTA_HDR_OFFSET, offset_str);
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "Invalid resume offset");
+        return ESP_FAIL;
+    }
+    esp_timer_stop(_self.timer);
+    ESP_LOGI(TAG, "Resuming OTA session at %u/%u bytes", _self.received, _self.total);
+    srv_progress_update(SRV_PROGRESS_STAGE_RECEIVE, _self.received, _self.written);
+    return ESP_OK;
+}
+
 // Handler to update OTA updates
 esp_err_t ota_post_handler(httpd_req_t *req) {
-    char *ota_buffer;
-    char *query_buf;
+    char *query_buf = NULL;
     int ota_type = -1;
-    ota_func_t ota_func;
+    int compression = OTA_COMPRESSION_AUTO;
+    bool is_resume = false;
+    size_t offset = 0;
+    uint8_t digest[UTILS_SHA256_SIZE];
+    char digest_hex[UTILS_SHA256_HEX_SIZE];
 
     size_t query_buf_len = httpd_req_get_url_query_len(req) + 1;
     if (query_buf_len > 1) {
         query_buf = malloc(query_buf_len);
-        if (httpd_req_get_url_query_str(req, query_buf, query_buf_len) == ESP_OK) {
+        if (query_buf && httpd_req_get_url_query_str(req, query_buf, query_buf_len) == ESP_OK) {
             char value[16];
             if (httpd_query_key_value(query_buf, "binaryType", value, sizeof(value)) == ESP_OK) {
-                if (!strcmp("esp32_app", value)) {
-                    ota_type = OTA_ESP32_APP;
-                } else if (!strcmp("esp32_littlefs", value)) {
-                    ota_type = OTA_ESP32_LITTLEFS;
-                } else if (!strcmp("ra4m1_app", value)) {
-                    ota_type = OTA_RA4M1_FIRMWARE;
-                }
+                ota_type = _ota_get_type(value);
                 ESP_LOGI(TAG, "OTA (type=%s [%d])", value, ota_type);
             }
+            if (httpd_query_key_value(query_buf, "compression", value, sizeof(value)) == ESP_OK) {
+                if (!strcmp("none", value)) {
+                    compression = OTA_COMPRESSION_NONE;
+                } else if (!strcmp("gzip", value)) {
+                    compression = OTA_COMPRESSION_GZIP;
+                } else {
+                    compression = -1;
+                }
+                ESP_LOGI(TAG, "OTA (compression=%s [%d])", value, compression);
+            }
+            if (httpd_query_key_value(query_buf, "offset", value, sizeof(value)) == ESP_OK) {
+                is_resume = true;
+                offset = strtoul(value, NULL, 10);
+                ESP_LOGI(TAG, "OTA (offset=%u)", offset);
+            }
         }
     }
     if (ota_type < 0) {
         ESP_LOGE(TAG, "Invalid or missing binaryType in the URI");
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid or missing binaryType in the URI");
+        free(query_buf);
         return ESP_FAIL;        
     }
-
-    ota_func = ota_types[ota_type];
-
-    ota_buffer = malloc(OTA_BUFFER_SIZE * sizeof(uint8_t));
-    if (ota_buffer == NULL) {
-        ESP_LOGE(TAG, "Unable to allocate OTA buffer (%d bytes)", OTA_BUFFER_SIZE);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to allocate OTA memory");
+    if (compression < 0) {
+        ESP_LOGE(TAG, "Unsupported compression in the URI");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unsupported compression (none or gzip)");
+        free(query_buf);
         return ESP_FAIL;
     }
 
-    esp_err_t err = ota_func.begin();
+    /* Compression and verification parameters of a resumed session are those of the first request */
+    esp_err_t err = is_resume ? _ota_session_resume(req, ota_type, offset) : _ota_session_begin(req, ota_type, compression, query_buf);
+    free(query_buf);
     if (err != ESP_OK) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to begin OTA update");
         return ESP_FAIL;
     }
 
-    /* File cannot be larger than the  partition size */
-    if (req->content_len > ota_func.get_partition()->size) {
-        ESP_LOGE(TAG, "OTA Binary too large : %d bytes", req->content_len);
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Binary too large !");
+    _self.write_err = ESP_OK;
+    if (_ota_pipeline_start() != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to allocate OTA memory");
+        _ota_session_end(true);
+        srv_progress_end(ESP_ERR_NO_MEM);
         return ESP_FAIL;
     }
 
     int received;
     int progress = 0;
-    int remaining = req->content_len;
+    int remaining = _self.total - _self.received;
     ESP_LOGI(TAG, "Flashing binary (%u bytes) ...", remaining);
-    while (remaining > 0) {
+    while (remaining > 0 && _self.write_err == ESP_OK) {
+        ota_buffer_t *buffer;
+        int64_t start = esp_timer_get_time();
+        xQueueReceive(_self.free_queue, &buffer, portMAX_DELAY);
+        _self.recv_wait_time += esp_timer_get_time() - start;
+
         /* Receive the file part by part into a buffer */
-        if ((received = httpd_req_recv(req, ota_buffer, MIN(remaining, OTA_BUFFER_SIZE))) > 0) {
-            err = ota_func.write(ota_buffer, received);
+        if ((received = _ota_receive(req, buffer, remaining)) <= 0) {
+            ESP_LOGE(TAG, "Failed to receive file!");
+            xQueueSend(_self.free_queue, &buffer, 0);
+            err = _ota_pipeline_stop(false);
             if (err != ESP_OK) {
-                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA update failed");
-                ota_func.abort();
+                _send_write_error(req, err);
+                _ota_session_end(true);
+                srv_progress_end(err);
                 return ESP_FAIL;
             }
-        } else {
-            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
-                /* Retry if timeout occurred */
-                continue;
+            /* Everything received so far is written, the upload can be resumed from there */
+            char offset_str[16];
+            if (_ota_session_suspend() == ESP_OK) {
+                snprintf(offset_str, sizeof(offset_str), "%u", _self.received);
+                httpd_resp_set_hdr(req, OTA_HDR_OFFSET, offset_str);
             }
-            ESP_LOGE(TAG, "Failed to receive file!");
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error while receiving app binary");
-            ota_func.abort();
             return ESP_FAIL;            
         }
+        xQueueSend(_self.filled_queue, &buffer, portMAX_DELAY);
+
+        _self.received += received;
         remaining -= received;
-        int new_progress = 100 - (100 * remaining) / req->content_len;
+        srv_progress_update(SRV_PROGRESS_STAGE_RECEIVE, _self.received, _self.written);
+        int new_progress = 100 - (100 * (size_t) remaining) / _self.total;
         if ((new_progress - progress) > 4) {
             progress = new_progress;
             ESP_LOGI(TAG, "%d %%", progress);
         }
     }
+
+    srv_progress_update(SRV_PROGRESS_STAGE_WRITE, _self.received, _self.written);
+    err = _ota_pipeline_stop(true);
+    _ota_log_stats();
+    if (err != ESP_OK) {
+        _send_write_error(req, err);
+        _ota_session_end(true);
+        srv_progress_end(err);
+        return ESP_FAIL;
+    }
+
+    /* Nothing is committed (boot partition, RA4M1 first block, remount) before verification */
+    srv_progress_update(SRV_PROGRESS_STAGE_VERIFY, _self.received, _self.written);
+    err = _ota_verify(digest);
+    utils_sha256_to_hex(digest, digest_hex);
+    ESP_LOGI(TAG, "Payload SHA-256: %s", digest_hex);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, (err == ESP_ERR_INVALID_CRC) ? "SHA-256 mismatch" : "Invalid or missing signature");
+        _ota_session_end(true);
+        srv_progress_end(err);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_hdr(req, SRV_FILE_HDR_SHA256, digest_hex);
+
+    srv_progress_update(SRV_PROGRESS_STAGE_COMMIT, _self.received, _self.written);
+    err = _self.func.end();
+    if (err == ESP_OK) {
+        err = _self.func.commit();
+    }
+    _ota_session_end(err != ESP_OK);
+    srv_progress_end(err);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "OTA update failed (%s)", esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA update failed (invalid image)");
+        return ESP_FAIL;
+    }
     ESP_LOGI(TAG, "OTA update completed successfully");
-    ota_func.end();
-    free(ota_buffer);
 
     return httpd_resp_sendstr(req, "OTA update completed successfully");
 }
+
+// Handler reporting the OTA session state (to resume an interrupted upload)
+esp_err_t ota_get_handler(httpd_req_t *req) {
+    cJSON *status = cJSON_CreateObject();
+    cJSON_AddBoolToObject(status, "active", _self.is_active);
+    if (_self.is_active) {
+        /* Digest of the data written so far (after decompression) */
+        mbedtls_sha256_context sha256_ctx;
+        uint8_t digest[UTILS_SHA256_SIZE];
+        char digest_hex[UTILS_SHA256_HEX_SIZE];
+        mbedtls_sha256_init(&sha256_ctx);
+        mbedtls_sha256_clone(&sha256_ctx, &_self.sha256_ctx);
+        mbedtls_sha256_finish(&sha256_ctx, digest);
+        mbedtls_sha256_free(&sha256_ctx);
+        utils_sha256_to_hex(digest, digest_hex);
+
+        cJSON_AddStringToObject(status, "binaryType", _self.func.name);
+        cJSON_AddNumberToObject(status, "offset", _self.received);
+        cJSON_AddNumberToObject(status, "total", _self.total);
+        cJSON_AddNumberToObject(status, "written", _self.written);
+        cJSON_AddStringToObject(status, "sha256", digest_hex);
+    }
+    char *json_str = cJSON_PrintUnformatted(status);
+    cJSON_Delete(status);
+    if (json_str == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    esp_err_t err = httpd_resp_sendstr(req, json_str);
+    free(json_str);
+    return err;
+}
@@ -10,6 +10,12 @@ typedef struct {
     size_t partition_offset;           /*!< Current offset in the partition */
     char* buffer;                      /*!< Buffer for writing data */
     size_t buffer_offset;              /*!< Current offset in the buffer */
+    char* flash_buffer;                /*!< Buffer for reading back flash content */
+    size_t sectors_written;            /*!< Sectors erased and written */
+    size_t sectors_erased;             /*!< Sectors erased only (blank in image) */
+    size_t sectors_skipped;            /*!< Sectors already up to date */
+    bool is_mounted;                   /*!< Partition was mounted (no A/B slots), unmounted while writing */
+    bool is_switched;                  /*!< Committed by switching slots, can be rolled back */
 } ota_littlefs_data_t;
 
 static const char *TAG = "ota_littlefs";
@@ -20,50 +26,93 @@ const esp_partition_t *ota_littlefs_get_partition() {
   return _self.partition;
 }
 
+static void _ota_littlefs_free() {
+    free(_self.buffer);
+    _self.buffer = NULL;
+    free(_self.flash_buffer);
+    _self.flash_buffer = NULL;
+}
+
 esp_err_t ota_littlefs_begin() {
     _self.buffer_offset = 0;
     _self.partition_offset = 0;
-    _self.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_LITTLEFS, NULL);
+    _self.sectors_written = 0;
+    _self.sectors_erased = 0;
+    _self.sectors_skipped = 0;
+    _self.is_switched = false;
+    /* Inactive slot, the mounted file system keeps serving files meanwhile */
+    _self.partition = srv_littlefs_get_update_partition();
     if( ! _self.partition) {
         ESP_LOGE(TAG, "No LITTLEFS partion found !");
         return ESP_FAIL;
     }
 
     _self.buffer = (char *) malloc(_self.partition->erase_size);
-    if( ! _self.buffer) {
+    _self.flash_buffer = (char *) malloc(_self.partition->erase_size);
+    if( ! _self.buffer || ! _self.flash_buffer) {
         ESP_LOGE(TAG, "Unable to allocate buffer memory !");
+        _ota_littlefs_free();
         return ESP_FAIL;
     }
 
-    srv_littlefs_stop();
+    _self.is_mounted = srv_littlefs_is_mounted(_self.partition);
+    if (_self.is_mounted) {
+        srv_littlefs_stop();
+    }
 
-    ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%"PRIx32"(size = 0x%"PRIx32")",
-            _self.partition->subtype, _self.partition->address, _self.partition->size);
+    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%"PRIx32"(size = 0x%"PRIx32")",
+            _self.partition->label, _self.partition->address, _self.partition->size);
 
     return ESP_OK;
 }
 
+static bool _is_blank(const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != (char) 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Write buffer to the current sector, skipping sectors already up to date
+   (the sector tail after len is expected to be erased) */
 esp_err_t _ota_littlefs_writeBuffer(size_t len) {
     esp_err_t err = ESP_OK;
+    size_t sector_size = _self.partition->erase_size;
+
+    /* Compare with the current flash content */
+    memset(_self.buffer + len, 0xFF, sector_size - len);
+    err = esp_partition_read(_self.partition, _self.partition_offset, _self.flash_buffer, sector_size);
+    if (err == ESP_OK && !memcmp(_self.buffer, _self.flash_buffer, sector_size)) {
+        _self.sectors_skipped++;
+        return ESP_OK;
+    }
 
-    err = esp_partition_erase_range(_self.partition, _self.partition_offset, _self.partition->erase_size);
+    err = esp_partition_erase_range(_self.partition, _self.partition_offset, sector_size);
     if (err != ESP_OK) {
             ESP_LOGE(TAG, "Unable to erase littlefs sector @ 0x%08x (%s)", _self.partition_offset, esp_err_to_name(err));
             return ESP_FAIL;            
     }
 
+    /* Blank sector: erase only */
+    if (_is_blank(_self.buffer, len)) {
+        _self.sectors_erased++;
+        return ESP_OK;
+    }
+
     err = esp_partition_write(_self.partition, _self.partition_offset, _self.buffer, len);
     if (err != ESP_OK) {
             ESP_LOGE(TAG, "Unable to write littlefs sector @ 0x%08x (%s)", _self.partition_offset, esp_err_to_name(err));
             return ESP_FAIL;            
     }
+    _self.sectors_written++;
     //ESP_LOGI(TAG, "Wrote %d bytes at 0x%08x", len , _self.partition_offset);
     return err;
 }
 
-// TODO: Add support for compressed FS ?
 esp_err_t ota_littlefs_write(char *data, size_t len) {
-    // FIXME: Need to check content to make sure it is a littlefs binary
+    // Content is verified by the OTA handler (SHA-256/signature) before ota_littlefs_commit() mounts it
     if ((_self.partition_offset + len) > _self.partition->size) {
         ESP_LOGE(TAG, "Not enough space left on flash!");
         return ESP_FAIL;
@@ -96,15 +145,36 @@ esp_err_t ota_littlefs_end() {
         err = _ota_littlefs_writeBuffer(_self.buffer_offset);
     }
 
-    free(_self.buffer);
-    ESP_LOGI(TAG, "OTA littlefs update succeeded");
+    _ota_littlefs_free();
+    ESP_LOGI(TAG, "OTA littlefs update written (sectors: %u written, %u erased, %u unchanged)",
+             _self.sectors_written, _self.sectors_erased, _self.sectors_skipped);
 
-    srv_littlefs_restart();
-    
+    return err;
+}
+
+esp_err_t ota_littlefs_commit() {
+    /* Switch to the updated slot (or remount the single partition) */
+    esp_err_t err = _self.is_mounted ? srv_littlefs_restart() : srv_littlefs_switch();
+    _self.is_switched = !_self.is_mounted && (err == ESP_OK);
+    _self.is_mounted = false;
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "OTA littlefs update succeeded");
+    }
     return err;
 }
 
 void ota_littlefs_abort() {
-    free(_self.buffer);
+    _ota_littlefs_free();
     ESP_LOGI(TAG, "OTA littlefs update aborted");
+
+    if (_self.is_mounted) {
+        srv_littlefs_restart();
+        _self.is_mounted = false;
+    }
+    if (_self.is_switched) {
+        /* Roll back a committed update (e.g. a later bundle image failed), the previous slot is intact */
+        ESP_LOGW(TAG, "Switching back to the previous file system");
+        srv_littlefs_switch();
+        _self.is_switched = false;
+    }
 }
\ No newline at end of file
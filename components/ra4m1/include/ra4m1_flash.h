@@ -1,6 +1,8 @@
 #ifndef _RA4M1_FLASH_H
 #define _RA4M1_FLASH_H
 
+#include <stdbool.h>
+
 #include "esp_err.h"
 #include "esp_partition.h"
 
@@ -8,6 +10,14 @@
 #define RA4M1_FLASH_NUM_PAGES  128
 #define RA4M1_FLASH_SIZE (RA4M1_FLASH_NUM_PAGES*RA4M1_FLASH_PAGE_SIZE)
 
+/**
+ * @brief Callback type reporting the progress of ra4m1_flash_image().
+ *
+ * @param written Bytes written so far.
+ * @param total   Image size in bytes.
+ */
+typedef void (*ra4m1_flash_progress_cb_t)(size_t written, size_t total);
+
 /**
  * @brief RA4M1 flash partition structure.
  *
@@ -17,12 +27,76 @@
  */
 const esp_partition_t *ra4m1_flash_get_partition();
 
+/**
+ * @brief Set the callback reporting the progress of ra4m1_flash_image().
+ *
+ * @param callback Progress callback (NULL to disable).
+ */
+void ra4m1_flash_set_progress_callback(ra4m1_flash_progress_cb_t callback);
+
+/**
+ * @brief Set the file keeping the last healthy RA4M1 image.
+ *
+ * Each flashed image is copied next to it (".new" suffix) and replaces it
+ * once the AYAB firmware answers a reqInfo after restart. If a new image does
+ * not answer, or programming fails once the flash is erased, this image is
+ * flashed back (see CONFIG_RA4M1_FIRMWARE_CHECK_TIMEOUT).
+ *
+ * @param path File path (e.g. "/littlefs/ra4m1_previous.bin"), NULL to disable rollback.
+ */
+void ra4m1_flash_set_backup_path(const char *path);
+
+/**
+ * @brief Copy the backup image (and its ".new" copy if any) to another path.
+ *
+ * Used to keep the backup when the file system holding it is replaced (e.g.
+ * LITTLEFS A/B switch): the copies are made to the new file system before it
+ * is mounted at the backup path.
+ *
+ * @param path Destination file path (".new" suffix added for the copy).
+ * @return ESP_OK on success (or nothing to copy), or an error code on failure.
+ */
+esp_err_t ra4m1_flash_copy_backup(const char *path);
+
+/**
+ * @brief Keep the backup image until ra4m1_flash_release_backup().
+ *
+ * Used when the RA4M1 firmware is part of a larger update (OTA bundle): an
+ * image committed meanwhile only replaces the backup once the whole update
+ * is committed, so that it can still be rolled back.
+ */
+void ra4m1_flash_hold_backup();
+
+/**
+ * @brief Release the backup image held by ra4m1_flash_hold_backup().
+ *
+ * @param is_committed true if the whole update was committed (the image
+ *        committed meanwhile replaces the backup), false to flash the backup
+ *        back if the RA4M1 flash was changed.
+ */
+void ra4m1_flash_release_backup(bool is_committed);
+
+/**
+ * @brief Check whether the RA4M1 is being programmed.
+ *
+ * Programming runs from ra4m1_flash_begin() until ra4m1_flash_commit() or
+ * ra4m1_flash_abort() returns (health check and rollback included), either
+ * from an OTA update or ra4m1_flash_image(). Also true while
+ * ra4m1_flash_image_is_current() reads an image file.
+ *
+ * @return true while programming is in progress.
+ */
+bool ra4m1_flash_is_busy();
+
 /**
  * @brief Initialize the RA4M1 flash for writing.
  *
- * This function prepares the flash memory for writing by erasing it and allocating a buffer.
+ * This function connects to the bootloader and allocates a buffer. The flash is
+ * erased when the first block differing from its current content (bootloader
+ * CRC16) is written: unchanged leading blocks are not reprogrammed.
  *
- * @return ESP_OK on success, or an error code on failure.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if programming is already
+ *         in progress (see ra4m1_flash_is_busy()), or another error code.
  */
 esp_err_t ra4m1_flash_begin();
 
@@ -40,16 +114,33 @@ esp_err_t ra4m1_flash_write(char *data, size_t len);
 /**
  * @brief Finalize the RA4M1 flash writing process.
  *
- * This function writes any remaining data in the buffer to the flash and cleans up resources.
+ * This function writes any remaining data in the buffer to the flash,
+ * the image is made bootable by ra4m1_flash_commit().
  *
  * @return ESP_OK on success, or an error code on failure.
  */
 esp_err_t ra4m1_flash_end();
 
+/**
+ * @brief Commit the RA4M1 flash writing process.
+ *
+ * This function writes the first block (vector table), making the image
+ * bootable, then cleans up resources and disconnects from the flash. A new
+ * image must then answer an AYAB reqInfo, otherwise the previous one is
+ * flashed back (see ra4m1_flash_set_backup_path()).
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE if the new firmware does
+ *         not answer, ESP_ERR_INVALID_STATE without ra4m1_flash_begin(), or
+ *         another error code on failure.
+ */
+esp_err_t ra4m1_flash_commit();
+
 /**
  * @brief Abort the RA4M1 flash writing process.
  *
  * This function cleans up resources and disconnects from the flash without writing any data.
+ * The previous image is flashed back if the flash was already erased. Does
+ * nothing once the session is committed.
  */
 void ra4m1_flash_abort();
 
@@ -63,4 +154,27 @@ void ra4m1_flash_abort();
  */
 esp_err_t ra4m1_flash_image(const char* filename);
 
+/**
+ * @brief Get the SHA-256 and size of the image currently in RA4M1 flash.
+ *
+ * @param[out] sha256 SHA-256 of the last successfully flashed image (32 bytes).
+ * @param[out] size   Size of the image in bytes.
+ * @return ESP_OK on success, or an error code if unknown (flash erased or never
+ *         programmed by this device).
+ */
+esp_err_t ra4m1_flash_get_image_info(uint8_t sha256[32], uint32_t *size);
+
+/**
+ * @brief Check whether a firmware image is the one currently in RA4M1 flash.
+ *
+ * The SHA-256 and size of the last successfully flashed image (OTA update or
+ * ra4m1_flash_image()) are kept in NVS, and cleared as soon as the flash is
+ * erased.
+ *
+ * @param filename Path to the firmware image file.
+ * @return true if the image matches the last flashed one (false if the RA4M1
+ *         is being programmed).
+ */
+bool ra4m1_flash_image_is_current(const char* filename);
+
 #endif
\ No newline at end of file
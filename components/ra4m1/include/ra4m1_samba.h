@@ -18,8 +18,24 @@ void ra4m1_samba_init(uart_port_t uartPort, int baud_rate);
  *
  * This function establishes a connection to the RA4M1 SAM-BA interface.
  * It should be called before any other SAM-BA operations.
+ * Responses are parsed up to their terminator so that connecting takes
+ * milliseconds instead of waiting for read timeouts.
+ * The first connection probes baud rates above the default one (up to
+ * CONFIG_RA4M1_SAMBA_MAX_BAUDRATE), validating each with I#/V# round trips;
+ * the fastest working rate is saved in NVS and used by the next connections,
+ * falling back to the default rate on failure. A stored rate that fails is
+ * cleared, so that the next connection probes again.
+ *
+ * @return ESP_OK on success, or an error code if the bootloader does not answer.
+ */
+esp_err_t ra4m1_samba_connect();
+
+/**
+ * @brief Get the baud rate of the current SAM-BA session.
+ *
+ * @return The baud rate selected by ra4m1_samba_connect().
  */
-void ra4m1_samba_connect();
+uint32_t ra4m1_samba_get_baudrate();
 
 /**
  * @brief Erase a section of the RA4M1 SAM-BA memory.
@@ -46,6 +62,9 @@ esp_err_t ra4m1_samba_load_buffer(const uint8_t* buffer, uint32_t size);
  * @brief Write a buffer to the RA4M1 SAM-BA memory.
  *
  * This function writes a buffer to the RA4M1 SAM-BA memory at a specified address.
+ * With CONFIG_RA4M1_SAMBA_DOUBLE_BUFFER the write acknowledgement is not awaited:
+ * the next buffer is loaded into the other slot while the bootloader programs
+ * flash, call ra4m1_samba_sync() to wait for the last write.
  *
  * @param dst_addr The destination address in the RA4M1 SAM-BA memory.
  * @param size The size of the data to write in bytes.
@@ -53,6 +72,39 @@ esp_err_t ra4m1_samba_load_buffer(const uint8_t* buffer, uint32_t size);
  */
 esp_err_t ra4m1_samba_write_buffer(uint32_t dst_addr, uint32_t size);
 
+/**
+ * @brief Wait for the completion of a pending buffer write.
+ *
+ * The written range is verified against the CRC16 of the loaded buffer
+ * (ra4m1_samba_checksum()) and rewritten from the buffer slot on mismatch.
+ *
+ * @return ESP_OK on success (or nothing pending), ESP_ERR_INVALID_CRC if the
+ *         block still mismatches after the retries, or another error code.
+ */
+esp_err_t ra4m1_samba_sync();
+
+/**
+ * @brief Compute the CRC16 of a range of the RA4M1 flash (SAM-BA 'Z' command).
+ *
+ * @param addr Start address of the range.
+ * @param size Size of the range in bytes.
+ * @param[out] crc CRC16 (XMODEM) computed by the bootloader.
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the bootloader does not
+ *         answer or does not implement the command (not retried until the next
+ *         connection).
+ */
+esp_err_t ra4m1_samba_checksum(uint32_t addr, uint32_t size, uint16_t *crc);
+
+/**
+ * @brief Update a CRC16 (XMODEM) with data, matching ra4m1_samba_checksum().
+ *
+ * @param crc Current CRC value (0 to start).
+ * @param data Data to add to the CRC.
+ * @param len Length of the data in bytes.
+ * @return The updated CRC value.
+ */
+uint16_t ra4m1_samba_crc16(uint16_t crc, const uint8_t *data, size_t len);
+
 /**
  * @brief Disconnect from the RA4M1 SAM-BA interface.
  *
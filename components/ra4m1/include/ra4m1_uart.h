@@ -1,9 +1,12 @@
 #ifndef _RA4M1_UART_H_
 #define _RA4M1_UART_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include "esp_err.h"
+
 typedef struct uart_tx_message {
     size_t len;
     uint8_t *payload;
@@ -42,4 +45,26 @@ void ra4m1_uart_rx(uart_msg_t *message);
  */
 int ra4m1_uart_tx(uart_msg_t *message);
 
+/**
+ * @brief Enable or disable the RA4M1 UART bridge.
+ *
+ * While disabled, ra4m1_uart_rx() and ra4m1_uart_tx() ignore traffic (as in
+ * programming mode) so that the UART can be used by ra4m1_uart_check_firmware().
+ *
+ * @param enabled true to forward traffic to/from the application.
+ */
+void ra4m1_uart_set_bridge_enabled(bool enabled);
+
+/**
+ * @brief Check that the AYAB firmware is running.
+ *
+ * A SLIP framed reqInfo (0x03) is sent every 200 ms until a cnfInfo (0xC3)
+ * is received or the deadline expires. The bridge should be disabled
+ * meanwhile.
+ *
+ * @param timeout_ms Deadline in milliseconds (firmware start included).
+ * @return ESP_OK if the firmware answered, ESP_ERR_TIMEOUT otherwise.
+ */
+esp_err_t ra4m1_uart_check_firmware(uint32_t timeout_ms);
+
 #endif
\ No newline at end of file
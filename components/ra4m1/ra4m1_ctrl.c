@@ -6,6 +6,10 @@
 #include "esp_log.h"
 #include "ra4m1_ctrl.h"
 
+// Reset timings, the bootloader cannot be probed before the double reset is complete
+#define RESET_PULSE_MS        10  // Reset low time (RES pin minimum is a few us, RC filtered)
+#define DOUBLE_RESET_DELAY_MS 100 // Between both resets, within the bootloader double reset window
+
 typedef struct {
     gpio_num_t resetPin;  /*!< GPIO pin for reset */
     gpio_num_t bootPin;   /*!< GPIO pin for boot mode */
@@ -55,7 +59,7 @@ void ra4m1_ctrl_reset_toggle() {
 void ra4m1_ctrl_restart() {
     ESP_LOGI(TAG, "Reset MCU");
     ra4m1_ctrl_resetPin_set(LOW);
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+    vTaskDelay(pdMS_TO_TICKS(RESET_PULSE_MS));
     ra4m1_ctrl_resetPin_set(HIGH);
 }
 
@@ -64,7 +68,7 @@ void ra4m1_ctrl_enter_programming() {
     _self.program_mode = true;
     // Double reset sequence tp enter programming mode
     ra4m1_ctrl_restart();
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+    vTaskDelay(pdMS_TO_TICKS(DOUBLE_RESET_DELAY_MS));
     ra4m1_ctrl_restart();
 }
 
@@ -1,10 +1,41 @@
 #include <stdio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
 
 #include "ra4m1_flash.h"
 #include "ra4m1_samba.h"
+#include "ra4m1_uart.h"
+#include "utils_sha256.h"
+
+// Last successfully flashed image (namespace shared with ra4m1_samba.c)
+#define NVS_RA4M1_NAMESPACE  "ra4m1"
+#define NVS_RA4M1_IMAGE_SHA  "image_sha"
+#define NVS_RA4M1_IMAGE_SIZE "image_size"
+
+#define BACKUP_PATH_MAX  64
+#define BACKUP_NEW_EXT   ".new" // Copy of the image being flashed, replaces the backup once healthy
+#define BACKUP_COPY_SIZE 1024   // Buffer size to copy the backup
+
+// Programming steps, timed to see where the time goes
+typedef enum {
+    FLASH_STEP_CONNECT,   // Reset into the bootloader and SAM-BA handshake
+    FLASH_STEP_COMPARE,   // CRC of the unchanged leading blocks
+    FLASH_STEP_ERASE,
+    FLASH_STEP_WRITE,     // Load, write and per block verification
+    FLASH_STEP_VERIFY,    // Final image CRC
+    FLASH_STEP_MAX
+} ra4m1_flash_step_t;
+
+static const char *_step_names[FLASH_STEP_MAX] = {"connect", "compare", "erase", "write", "verify"};
 
 typedef struct {
     const esp_partition_t partition; // Pointer to the partition structure
@@ -12,6 +43,27 @@ typedef struct {
     size_t flash_offset;  // Offset in the flash memory
     uint32_t bufferSize;  // Size of the buffer used for writing
     uint8_t *buffer;      // Pointer to the buffer used for writing
+    uint8_t *first_block; // First block (vector table), written last so that an incomplete image never boots
+    bool has_first_block; // First block received
+    bool is_connected;    // Connected to the SAM-BA bootloader
+    atomic_bool is_busy;  // Programming in progress (OTA or ra4m1_flash_image, from any task)
+    bool is_open;         // Session opened by ra4m1_flash_begin(), until ra4m1_flash_commit() or ra4m1_flash_abort()
+    bool is_erased;       // Flash erased from erase_offset, remaining blocks are written
+    size_t erase_offset;  // Offset of the first block that differs from the flash content
+    size_t image_size;    // Size of the (padded) image received so far
+    uint16_t image_crc;   // CRC16 of the image received so far (final verification)
+    size_t image_length;  // Size of the image received so far (without padding)
+    mbedtls_sha256_context sha256_ctx; // SHA-256 of the image (saved in NVS once flashed)
+    int64_t write_start;  // Programming start time (us), for throughput logging
+    size_t bytes_written; // Bytes programmed since ra4m1_flash_begin()
+    int64_t step_time[FLASH_STEP_MAX]; // Time spent in each step (us)
+    ra4m1_flash_progress_cb_t progress_cb; // Progress callback (ra4m1_flash_image)
+    char backup_path[BACKUP_PATH_MAX]; // Last healthy image, reflashed if a new one does not answer ("" to disable)
+    FILE *fd_new;         // Copy of the image being flashed (BACKUP_NEW_EXT)
+    bool is_rollback;     // Reflashing the backup image
+    bool is_backup_held;  // Backup kept until ra4m1_flash_release_backup() (OTA bundle)
+    bool is_held_flashed; // New image committed while the backup was held
+    bool is_held_copy;    // Copy of that image (BACKUP_NEW_EXT) waiting to replace the backup
 } ra4m1_flash_data_t;
 
 static const char *TAG = "ra4m1_flash";
@@ -27,50 +79,317 @@ const esp_partition_t *ra4m1_flash_get_partition() {
     return &_self.partition;
 }
 
-esp_err_t ra4m1_flash_begin() {
+void ra4m1_flash_set_progress_callback(ra4m1_flash_progress_cb_t callback) {
+    _self.progress_cb = callback;
+}
+
+void ra4m1_flash_set_backup_path(const char *path) {
+    strlcpy(_self.backup_path, path ? path : "", sizeof(_self.backup_path));
+}
+
+static void _ra4m1_flash_get_new_path(char *path, size_t size) {
+    snprintf(path, size, "%s" BACKUP_NEW_EXT, _self.backup_path);
+}
+
+static esp_err_t _ra4m1_flash_copy_file(const char *src, const char *dst) {
+    FILE *fd_src = fopen(src, "rb");
+    if (fd_src == NULL) {
+        /* Nothing to copy */
+        return ESP_OK;
+    }
+    esp_err_t err = ESP_OK;
+    uint8_t *buffer = malloc(BACKUP_COPY_SIZE);
+    FILE *fd_dst = fopen(dst, "wb");
+    if (buffer == NULL || fd_dst == NULL) {
+        err = ESP_FAIL;
+    } else {
+        size_t len;
+        while ((len = fread(buffer, 1, BACKUP_COPY_SIZE, fd_src)) > 0) {
+            if (fwrite(buffer, 1, len, fd_dst) != len) {
+                err = ESP_FAIL;
+                break;
+            }
+        }
+    }
+    if (fd_dst && fclose(fd_dst) != 0) {
+        err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        unlink(dst);
+    }
+    free(buffer);
+    fclose(fd_src);
+    return err;
+}
+
+esp_err_t ra4m1_flash_copy_backup(const char *path) {
+    char src[BACKUP_PATH_MAX + sizeof(BACKUP_NEW_EXT)];
+    char dst[BACKUP_PATH_MAX + sizeof(BACKUP_NEW_EXT)];
+
+    if (_self.backup_path[0] == '\0') {
+        return ESP_OK;
+    }
+    esp_err_t err = _ra4m1_flash_copy_file(_self.backup_path, path);
+    if (err == ESP_OK) {
+        /* Image committed while the backup is held (OTA bundle) */
+        _ra4m1_flash_get_new_path(src, sizeof(src));
+        snprintf(dst, sizeof(dst), "%s" BACKUP_NEW_EXT, path);
+        err = _ra4m1_flash_copy_file(src, dst);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to copy %s to %s", _self.backup_path, path);
+    }
+    return err;
+}
+
+/* Drop the copy of the image being flashed */
+static void _ra4m1_flash_discard_new() {
+    char path[BACKUP_PATH_MAX + sizeof(BACKUP_NEW_EXT)];
+
+    if (_self.fd_new) {
+        fclose(_self.fd_new);
+        _self.fd_new = NULL;
+        _ra4m1_flash_get_new_path(path, sizeof(path));
+        unlink(path);
+    }
+}
+
+/* Hash (and keep a copy of) the image data */
+static void _ra4m1_flash_update_image(const uint8_t *data, size_t len) {
+    mbedtls_sha256_update(&_self.sha256_ctx, data, len);
+    _self.image_length += len;
+
+    if (_self.fd_new && fwrite(data, 1, len, _self.fd_new) != len) {
+        ESP_LOGW(TAG, "Unable to keep a copy of the image, no rollback to it");
+        _ra4m1_flash_discard_new();
+    }
+}
+
+static void _ra4m1_flash_free() {
+    free(_self.buffer);
+    _self.buffer = NULL;
+    free(_self.first_block);
+    _self.first_block = NULL;
+    if (_self.is_connected) {
+        ra4m1_samba_disconnect();
+        _self.is_connected = false;
+    }
+    mbedtls_sha256_free(&_self.sha256_ctx);
+    _ra4m1_flash_discard_new();
+}
+
+static int64_t _ra4m1_flash_step_begin() {
+    return esp_timer_get_time();
+}
+
+static void _ra4m1_flash_step_end(ra4m1_flash_step_t step, int64_t start) {
+    _self.step_time[step] += esp_timer_get_time() - start;
+}
+
+static void _ra4m1_flash_log_steps() {
+    ESP_LOGI(TAG, "Steps: %s %lld ms, %s %lld ms, %s %lld ms, %s %lld ms, %s %lld ms",
+             _step_names[FLASH_STEP_CONNECT], _self.step_time[FLASH_STEP_CONNECT] / 1000,
+             _step_names[FLASH_STEP_COMPARE], _self.step_time[FLASH_STEP_COMPARE] / 1000,
+             _step_names[FLASH_STEP_ERASE], _self.step_time[FLASH_STEP_ERASE] / 1000,
+             _step_names[FLASH_STEP_WRITE], _self.step_time[FLASH_STEP_WRITE] / 1000,
+             _step_names[FLASH_STEP_VERIFY], _self.step_time[FLASH_STEP_VERIFY] / 1000);
+}
+
+bool ra4m1_flash_is_busy() {
+    return atomic_load(&_self.is_busy);
+}
+
+/* Take the flasher, released by _ra4m1_flash_release() once everything (rollback included) is over */
+static esp_err_t _ra4m1_flash_acquire() {
+    if (atomic_exchange(&_self.is_busy, true)) {
+        ESP_LOGW(TAG, "RA4M1 programming already in progress");
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+static void _ra4m1_flash_release() {
+    atomic_store(&_self.is_busy, false);
+}
+
+/* Start programming (flasher acquired) */
+static esp_err_t _ra4m1_flash_start() {
     _self.buffer_offset = 0;
     _self.flash_offset = 0;
-    
-    ra4m1_samba_connect();
+    _self.image_length = 0;
+    _self.is_erased = false;
+    mbedtls_sha256_init(&_self.sha256_ctx);
+    mbedtls_sha256_starts(&_self.sha256_ctx, 0);
+    memset(_self.step_time, 0, sizeof(_self.step_time));
 
-    ESP_LOGI(TAG, "Programming flash");
-    if (ra4m1_samba_erase(0) != ESP_OK) {
-        ESP_LOGE(TAG, "Flash erase failed");
-        return ESP_FAIL;
+    if (_self.backup_path[0] && ! _self.is_rollback) {
+        char path[BACKUP_PATH_MAX + sizeof(BACKUP_NEW_EXT)];
+        _ra4m1_flash_get_new_path(path, sizeof(path));
+        _self.fd_new = fopen(path, "wb");
+        if (_self.fd_new == NULL) {
+            ESP_LOGW(TAG, "Unable to create %s, no rollback to this image", path);
+        }
     }
-    ESP_LOGI(TAG, "Flash erased");
 
-    vTaskDelay(100 / portTICK_PERIOD_MS); // Wait for the flash erase to complete
+    int64_t start = _ra4m1_flash_step_begin();
+    esp_err_t err = ra4m1_samba_connect();
+    _ra4m1_flash_step_end(FLASH_STEP_CONNECT, start);
+    _self.is_connected = true;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to connect to SAM-BA bootloader");
+        _ra4m1_flash_free();
+        return err;
+    }
+
+    /* Flash is erased (from the first changed block) once the image content is known */
+    ESP_LOGI(TAG, "Programming flash");
+    _self.erase_offset = 0;
+    _self.image_size = 0;
+    _self.image_crc = 0;
 
     _self.bufferSize = ra4m1_samba_write_bufferSize();
     _self.buffer = (uint8_t *) malloc(_self.bufferSize);
-    if( ! _self.buffer) {
+    _self.first_block = (uint8_t *) malloc(_self.bufferSize);
+    _self.has_first_block = false;
+    _self.bytes_written = 0;
+    _self.write_start = esp_timer_get_time();
+    if( ! _self.buffer || ! _self.first_block) {
         ESP_LOGE(TAG, "Unable to allocate buffer memory");
+        _ra4m1_flash_free();
         return ESP_ERR_NO_MEM;
     }
     return ESP_OK;
 }
 
-esp_err_t _ra4m1_flash_writeBuffer() {
-    if (ra4m1_samba_load_buffer(_self.buffer, _self.bufferSize) == ESP_OK) {
-        if (ra4m1_samba_write_buffer(_self.flash_offset, _self.bufferSize) != ESP_OK) {
+/* Image info (SHA-256 and size) of the last successfully flashed image */
+static esp_err_t _ra4m1_flash_load_image_info(uint8_t sha256[32], uint32_t *size) {
+    nvs_handle_t nvs;
+    size_t sha256_len = 32;
+    esp_err_t err = nvs_open(NVS_RA4M1_NAMESPACE, NVS_READONLY, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_get_blob(nvs, NVS_RA4M1_IMAGE_SHA, sha256, &sha256_len);
+        if (err == ESP_OK) {
+            err = nvs_get_u32(nvs, NVS_RA4M1_IMAGE_SIZE, size);
+        }
+        nvs_close(nvs);
+    }
+    return err;
+}
+
+/* Save the image info, or clear it (sha256 NULL) as soon as the flash content changes */
+static void _ra4m1_flash_save_image_info(const uint8_t sha256[32], uint32_t size) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_RA4M1_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        if (sha256) {
+            err = nvs_set_blob(nvs, NVS_RA4M1_IMAGE_SHA, sha256, 32);
+            if (err == ESP_OK) {
+                err = nvs_set_u32(nvs, NVS_RA4M1_IMAGE_SIZE, size);
+            }
+        } else {
+            err = nvs_erase_key(nvs, NVS_RA4M1_IMAGE_SHA);
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                err = ESP_OK;
+            }
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to save RA4M1 image info (%s)", esp_err_to_name(err));
+    }
+}
+
+static esp_err_t _ra4m1_flash_erase(size_t offset) {
+    _ra4m1_flash_save_image_info(NULL, 0);
+
+    int64_t start = _ra4m1_flash_step_begin();
+    esp_err_t err = ra4m1_samba_erase(offset);
+    _ra4m1_flash_step_end(FLASH_STEP_ERASE, start);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Flash erase failed");
+        return ESP_FAIL;
+    }
+    /* The 'X' acknowledgement is only sent once the erase is complete */
+    ESP_LOGI(TAG, "Flash erased from 0x%05x", offset);
+
+    _self.is_erased = true;
+    _self.erase_offset = offset;
+    return ESP_OK;
+}
+
+/* Compare a block with the flash content (bootloader CRC16) */
+static bool _ra4m1_flash_is_unchanged(const uint8_t *buffer, size_t offset) {
+    uint16_t crc;
+
+    int64_t start = _ra4m1_flash_step_begin();
+    esp_err_t err = ra4m1_samba_checksum(offset, _self.bufferSize, &crc);
+    _ra4m1_flash_step_end(FLASH_STEP_COMPARE, start);
+    if (err != ESP_OK)
+        return false;
+
+    return crc == ra4m1_samba_crc16(0, buffer, _self.bufferSize);
+}
+
+static esp_err_t _ra4m1_flash_load_and_write(const uint8_t *buffer, size_t offset) {
+    esp_err_t err = ESP_OK;
+    int64_t start = _ra4m1_flash_step_begin();
+    if (ra4m1_samba_load_buffer(buffer, _self.bufferSize) == ESP_OK) {
+        if (ra4m1_samba_write_buffer(offset, _self.bufferSize) != ESP_OK) {
             ESP_LOGE(TAG, "Unable to write buffer to flash");
-            return ESP_FAIL;   
+            err = ESP_FAIL;
+        } else {
+            _self.bytes_written += _self.bufferSize;
         }
     } else {
         ESP_LOGE(TAG, "Unable to load buffer");
-        return ESP_FAIL;               
+        err = ESP_FAIL;
     }
-    return ESP_OK;
+    _ra4m1_flash_step_end(FLASH_STEP_WRITE, start);
+    return err;
+}
+
+/* Wait for the pending write (and its verification) to complete */
+static esp_err_t _ra4m1_flash_sync() {
+    int64_t start = _ra4m1_flash_step_begin();
+    esp_err_t err = ra4m1_samba_sync();
+    _ra4m1_flash_step_end(FLASH_STEP_WRITE, start);
+    return err;
+}
+
+esp_err_t _ra4m1_flash_writeBuffer() {
+    _self.image_crc = ra4m1_samba_crc16(_self.image_crc, _self.buffer, _self.bufferSize);
+    _self.image_size += _self.bufferSize;
+
+    if (! _self.is_erased) {
+        /* The erase command clears the flash up to its end: only the unchanged leading blocks can be skipped */
+        if (_ra4m1_flash_is_unchanged(_self.buffer, _self.flash_offset)) {
+            return ESP_OK;
+        }
+        if (_ra4m1_flash_erase(_self.flash_offset) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    if (_self.flash_offset == 0) {
+        /* Deferred until the whole image is written (and verified) */
+        memcpy(_self.first_block, _self.buffer, _self.bufferSize);
+        _self.has_first_block = true;
+        return ESP_OK;
+    }
+    return _ra4m1_flash_load_and_write(_self.buffer, _self.flash_offset);
 }
 
 esp_err_t ra4m1_flash_write(char *data, size_t len) {
-    // FIXME: Need to check content to make sure it is a correct binary ?
+    // Content is verified by the OTA handler (SHA-256/signature) before ra4m1_flash_commit() makes it bootable
     if ((_self.flash_offset + len) > _self.partition.size) {
         ESP_LOGE(TAG, "Not enough space left on flash");
         return ESP_FAIL;
     }
 
+    _ra4m1_flash_update_image((const uint8_t *) data, len);
+
     size_t data_left = len;
     while ((_self.buffer_offset + data_left) >= _self.bufferSize) {
         size_t data_to_cpy = _self.bufferSize - _self.buffer_offset;
@@ -96,65 +415,310 @@ esp_err_t ra4m1_flash_end() {
     if (_self.buffer_offset != 0) {
         memset(_self.buffer + _self.buffer_offset, 0, _self.bufferSize - _self.buffer_offset);
         err = _ra4m1_flash_writeBuffer();
+        _self.buffer_offset = 0;
+    }
+    if (err == ESP_OK) {
+        err = _ra4m1_flash_sync();
     }
+    return err;
+}
 
-    free(_self.buffer);
-    ra4m1_samba_disconnect();
+static void _ra4m1_flash_log_throughput() {
+    int64_t elapsed = esp_timer_get_time() - _self.write_start;
+    if (elapsed > 0) {
+        ESP_LOGI(TAG, "Programmed %u bytes in %lld ms (%llu B/s, %lu baud, %s buffering)",
+                 _self.bytes_written, elapsed / 1000, (uint64_t) _self.bytes_written * 1000000 / elapsed,
+                 (unsigned long) ra4m1_samba_get_baudrate(),
+#ifdef CONFIG_RA4M1_SAMBA_DOUBLE_BUFFER
+                 "double"
+#else
+                 "single"
+#endif
+        );
+    }
+    _ra4m1_flash_log_steps();
+}
+
+/* The image just flashed answered: it becomes the one to roll back to */
+static void _ra4m1_flash_promote_new() {
+    char path[BACKUP_PATH_MAX + sizeof(BACKUP_NEW_EXT)];
 
+    if (_self.fd_new) {
+        fclose(_self.fd_new);
+        _self.fd_new = NULL;
+    }
+    _ra4m1_flash_get_new_path(path, sizeof(path));
+    unlink(_self.backup_path);
+    if (rename(path, _self.backup_path) != 0) {
+        ESP_LOGW(TAG, "Unable to save %s", _self.backup_path);
+        unlink(path);
+    }
+}
+
+static esp_err_t _ra4m1_flash_program(const char* filename);
+
+/* Reflash the last healthy image after a new one failed to program or to answer (flasher acquired) */
+static void _ra4m1_flash_rollback() {
+    struct stat st;
+
+    if (_self.backup_path[0] == '\0' || stat(_self.backup_path, &st) != 0) {
+        ESP_LOGE(TAG, "No previous RA4M1 firmware to roll back to");
+        return;
+    }
+    ESP_LOGW(TAG, "Rolling back to the previous RA4M1 firmware (%s)", _self.backup_path);
+    _self.is_rollback = true;
+    esp_err_t err = _ra4m1_flash_program(_self.backup_path);
+    _self.is_rollback = false;
     if (err == ESP_OK) {
+        ESP_LOGI(TAG, "RA4M1 firmware rollback succeeded");
+    } else {
+        ESP_LOGE(TAG, "RA4M1 firmware rollback failed (%s)", esp_err_to_name(err));
+    }
+}
+
+void ra4m1_flash_hold_backup() {
+    _self.is_backup_held = true;
+    _self.is_held_flashed = false;
+    _self.is_held_copy = false;
+}
+
+void ra4m1_flash_release_backup(bool is_committed) {
+    char path[BACKUP_PATH_MAX + sizeof(BACKUP_NEW_EXT)];
+    bool is_rollback_needed = ! is_committed && _self.is_held_flashed;
+
+    if (_self.is_held_copy) {
+        if (is_committed) {
+            _ra4m1_flash_promote_new();
+        } else {
+            _ra4m1_flash_get_new_path(path, sizeof(path));
+            unlink(path);
+        }
+    }
+    _self.is_backup_held = false;
+    _self.is_held_flashed = false;
+    _self.is_held_copy = false;
+
+    if (is_rollback_needed) {
+        ESP_LOGW(TAG, "Update not committed, restoring the previous RA4M1 firmware");
+        if (_ra4m1_flash_acquire() == ESP_OK) {
+            _ra4m1_flash_rollback();
+            _ra4m1_flash_release();
+        }
+    }
+}
+
+/* Make the image bootable, check it and roll back if needed (flasher acquired) */
+static esp_err_t _ra4m1_flash_finish() {
+    esp_err_t err = ESP_OK;
+    if (_self.has_first_block) {
+        /* Image complete, make it bootable */
+        err = _ra4m1_flash_load_and_write(_self.first_block, 0);
+        if (err == ESP_OK) {
+            err = _ra4m1_flash_sync();
+        }
+        _self.has_first_block = false;
+    }
+
+    if (err == ESP_OK && _self.is_erased) {
+        /* Final verification of the whole image (single CRC round trip) */
+        uint16_t crc;
+        int64_t start = _ra4m1_flash_step_begin();
+        esp_err_t crc_err = ra4m1_samba_checksum(0, _self.image_size, &crc);
+        _ra4m1_flash_step_end(FLASH_STEP_VERIFY, start);
+        if (crc_err == ESP_OK && crc != _self.image_crc) {
+            ESP_LOGE(TAG, "Flash verification failed (CRC 0x%04x, expected 0x%04x)", crc, _self.image_crc);
+            err = ESP_ERR_INVALID_CRC;
+        }
+    }
+
+    uint8_t sha256[32];
+    FILE *fd_new = NULL;
+    if (err == ESP_OK) {
+        mbedtls_sha256_finish(&_self.sha256_ctx, sha256);
+        /* Kept until the new firmware is known to be healthy */
+        fd_new = _self.fd_new;
+        _self.fd_new = NULL;
+    }
+
+    /* The bridge must not consume the health check answer once the RA4M1 restarts */
+    ra4m1_uart_set_bridge_enabled(false);
+    _ra4m1_flash_free();
+
+    if (err == ESP_OK) {
+        if (! _self.is_erased) {
+            ESP_LOGI(TAG, "RA4M1 firmware unchanged");
+        } else if (_self.erase_offset > 0) {
+            ESP_LOGI(TAG, "Skipped %u unchanged bytes", _self.erase_offset);
+        }
+        _ra4m1_flash_log_throughput();
+
+        if (_self.is_erased && CONFIG_RA4M1_FIRMWARE_CHECK_TIMEOUT > 0 &&
+            ra4m1_uart_check_firmware(CONFIG_RA4M1_FIRMWARE_CHECK_TIMEOUT) != ESP_OK) {
+            ESP_LOGE(TAG, "RA4M1 firmware does not answer");
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    ra4m1_uart_set_bridge_enabled(true);
+
+    if (err == ESP_OK && _self.is_backup_held && ! _self.is_rollback) {
+        /* Promoted (or rolled back) once the whole bundle is committed */
+        _self.is_held_flashed = _self.is_erased;
+        _self.is_held_copy = (fd_new != NULL);
+        if (fd_new) {
+            fclose(fd_new);
+        }
+    } else if (fd_new) {
+        _self.fd_new = fd_new;
+        if (err == ESP_OK) {
+            _ra4m1_flash_promote_new();
+        } else {
+            _ra4m1_flash_discard_new();
+        }
+    }
+
+    if (err == ESP_OK) {
+        _ra4m1_flash_save_image_info(sha256, _self.image_length);
         ESP_LOGI(TAG, "RA4M1 firmware update succeeded");
+    } else if (_self.is_erased && ! _self.is_rollback) {
+        _ra4m1_flash_rollback();
     }
 
+    _self.is_erased = false;
     return err;
 }
 
-void ra4m1_flash_abort() {
-    free(_self.buffer);
-    ra4m1_samba_disconnect();
+/* Stop programming and roll back if needed (flasher acquired) */
+static void _ra4m1_flash_cancel() {
+    _ra4m1_flash_free();
+    _ra4m1_flash_log_steps();
     ESP_LOGI(TAG, "RA4M1 firmware update aborted");
+    if (_self.is_erased && ! _self.is_rollback) {
+        /* Partially programmed, the RA4M1 would not boot */
+        _ra4m1_flash_rollback();
+    }
+    _self.is_erased = false;
 }
 
-esp_err_t ra4m1_flash_image(const char* filename) {
+esp_err_t ra4m1_flash_begin() {
+    esp_err_t err = _ra4m1_flash_acquire();
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = _ra4m1_flash_start();
+    if (err != ESP_OK) {
+        _ra4m1_flash_release();
+        return err;
+    }
+    _self.is_open = true;
+    return ESP_OK;
+}
+
+esp_err_t ra4m1_flash_commit() {
+    if (! _self.is_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Flasher kept until the health check (and rollback) is over */
+    esp_err_t err = _ra4m1_flash_finish();
+    _self.is_open = false;
+    _ra4m1_flash_release();
+    return err;
+}
+
+void ra4m1_flash_abort() {
+    /* Nothing to abort once committed (or for another session) */
+    if (! _self.is_open) {
+        return;
+    }
+    _ra4m1_flash_cancel();
+    _self.is_open = false;
+    _ra4m1_flash_release();
+}
+
+/* Program an image file (flasher acquired) */
+static esp_err_t _ra4m1_flash_program(const char* filename) {
     FILE *fd_image = NULL;
     long image_size;
 
-    esp_err_t err = ra4m1_flash_begin();
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Opening firmware image (%s)", filename);
-        fd_image = fopen(filename, "rb");
-        if (! fd_image) {
-            ESP_LOGE(TAG, "Unable to open firmware image !");
+    esp_err_t err = _ra4m1_flash_start();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Opening firmware image (%s)", filename);
+    fd_image = fopen(filename, "rb");
+    if (! fd_image) {
+        ESP_LOGE(TAG, "Unable to open firmware image !");
+        err = ESP_FAIL;
+    } else {
+        if (fseek(fd_image, 0, SEEK_END) != 0 || (image_size = ftell(fd_image)) < 0) {
+            ESP_LOGE(TAG, "Unable to retrieve image size !");
             err = ESP_FAIL;
         } else {
-            if (fseek(fd_image, 0, SEEK_END) != 0 || (image_size = ftell(fd_image)) < 0) {
-                ESP_LOGE(TAG, "Unable to retrieve image size !");
+            if (image_size > RA4M1_FLASH_SIZE) {
+                ESP_LOGW(TAG, "File too large !");
                 err = ESP_FAIL;
             } else {
-                if (image_size > RA4M1_FLASH_SIZE) {
-                    ESP_LOGW(TAG, "File too large !");
-                    err = ESP_FAIL;
-                } else {
-                    size_t bytes_read;
-                    ESP_LOGI(TAG, "About to write %lu bytes to flash (%lu bytes)", (unsigned long) image_size, (unsigned long) RA4M1_FLASH_SIZE);
-                    rewind(fd_image);
-                    while ((err == ESP_OK) && ((bytes_read = fread(_self.buffer, 1, _self.bufferSize, fd_image)) > 0)) {
-                        ESP_LOGI(TAG, "%lu %%", (100 * _self.flash_offset) / image_size);
-                        if (bytes_read == _self.bufferSize) {
-                            err = _ra4m1_flash_writeBuffer();
-                            _self.flash_offset += _self.bufferSize;
-                        } else {
-                            _self.buffer_offset += bytes_read;
-                            ra4m1_flash_end();
-                            break;
-                        }
+                size_t bytes_read;
+                ESP_LOGI(TAG, "About to write %lu bytes to flash (%lu bytes)", (unsigned long) image_size, (unsigned long) RA4M1_FLASH_SIZE);
+                rewind(fd_image);
+                while ((err == ESP_OK) && ((bytes_read = fread(_self.buffer, 1, _self.bufferSize, fd_image)) > 0)) {
+                    _ra4m1_flash_update_image(_self.buffer, bytes_read);
+                    ESP_LOGI(TAG, "%lu %%", (100 * _self.flash_offset) / image_size);
+                    if (_self.progress_cb) {
+                        _self.progress_cb(_self.flash_offset, image_size);
+                    }
+                    if (bytes_read == _self.bufferSize) {
+                        err = _ra4m1_flash_writeBuffer();
+                        _self.flash_offset += _self.bufferSize;
+                    } else {
+                        _self.buffer_offset += bytes_read;
+                        break;
                     }
                 }
             }
-            fclose(fd_image);
         }
+        fclose(fd_image);
+    }
+    if (err == ESP_OK) {
+        /* Write the last (partial) and first blocks */
+        err = ra4m1_flash_end();
+    }
+    if (err == ESP_OK) {
+        return _ra4m1_flash_finish();
     }
+    _ra4m1_flash_cancel();
+    return err;
+}
+
+esp_err_t ra4m1_flash_image(const char* filename) {
+    esp_err_t err = _ra4m1_flash_acquire();
     if (err != ESP_OK) {
-        ra4m1_flash_abort();
+        return err;
     }
+    err = _ra4m1_flash_program(filename);
+    _ra4m1_flash_release();
     return err;
+}
+
+esp_err_t ra4m1_flash_get_image_info(uint8_t sha256[32], uint32_t *size) {
+    return _ra4m1_flash_load_image_info(sha256, size);
+}
+
+bool ra4m1_flash_image_is_current(const char* filename) {
+    uint8_t stored_sha256[UTILS_SHA256_SIZE];
+    uint8_t sha256[UTILS_SHA256_SIZE];
+    uint32_t stored_size;
+    size_t size;
+
+    if (_ra4m1_flash_load_image_info(stored_sha256, &stored_size) != ESP_OK)
+        return false;
+    /* Busy while the image file is read (see ra4m1_flash_is_busy()) */
+    if (_ra4m1_flash_acquire() != ESP_OK)
+        return false;
+    esp_err_t err = utils_sha256_file(filename, sha256, &size);
+    _ra4m1_flash_release();
+    if (err != ESP_OK)
+        return false;
+
+    return size == stored_size && memcmp(sha256, stored_sha256, sizeof(sha256)) == 0;
 }
\ No newline at end of file
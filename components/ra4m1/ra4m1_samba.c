@@ -1,64 +1,289 @@
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/param.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
 
 #include "ra4m1_ctrl.h"
 #include "ra4m1_samba.h"
 
-// Timeout definitions for serial read
+// Timeout definitions for serial read (per command deadlines)
+#define TIMEOUT_CMD     (100 / portTICK_PERIOD_MS)  // Short replies (N#, I#, V#)
 #define TIMEOUT_NORMAL  (1000 / portTICK_PERIOD_MS)
 #define TIMEOUT_LONG    (5000 / portTICK_PERIOD_MS)
+#define TIMEOUT_READY   (1000 / portTICK_PERIOD_MS)  // Bootloader start after the double reset
+#define PROBE_INTERVAL  (20 / portTICK_PERIOD_MS)    // Reply deadline of a readiness probe
+
+// SAM-BA response terminator
+#define RESPONSE_TERMINATOR     "\n\r"
+#define RESPONSE_TERMINATOR_LEN 2
 
 // Bootloader buffer offser (no applet -> 0)
 #define BUFFER_START_ADDRESS ((long unsigned int) 0)
+#define BUFFER_SIZE 4096
+
+// Buffer slots, the next block is loaded into one while the other is written (double buffering)
+#ifdef CONFIG_RA4M1_SAMBA_DOUBLE_BUFFER
+#define BUFFER_SLOTS 2
+#else
+#define BUFFER_SLOTS 1
+#endif
+#define BUFFER_SLOT_ADDRESS(slot) (BUFFER_START_ADDRESS + (slot) * BUFFER_SIZE)
+
+// Higher baud rates probed (fastest first, each one with its own reset into the bootloader)
+// until one answers, then kept in NVS. The default rate is never kept: a failing stored rate
+// is cleared and the higher rates are probed again by the next connection
+#define NVS_RA4M1_NAMESPACE "ra4m1"
+#define NVS_RA4M1_BAUDRATE  "baudrate"
+
+static const uint32_t _baud_rates[] = { 2000000, 1000000, 921600, 460800 };
+
+// Rewrites of a block failing its post-write CRC verification
+#define WRITE_RETRIES 2
 
 typedef struct {
     uint32_t baud_rate;  // Baud rate for the UART connection
     uint32_t saved_baud_rate; // Saved baud rate before connecting to samba
+    uint32_t current_baud_rate; // Baud rate of the current samba session
     uart_port_t uartPort; // UART port used for samba communication
+    unsigned int slot;    // Buffer slot used by the next load/write
+    bool is_write_pending; // Flash write issued, acknowledgement not read yet
+    uint32_t pending_addr; // Destination of the pending write
+    uint32_t pending_size; // Size of the pending write
+    unsigned int pending_slot; // Buffer slot of the pending write
+    uint16_t slot_crc[BUFFER_SLOTS]; // CRC16 of the data loaded in each slot
+    bool is_checksum_supported; // Bootloader implements the 'Z' (CRC16) command
 } ra4m1_samba_data_t;
 
 static const char *TAG = "ra4m1_samba";
 
 static ra4m1_samba_data_t _self;
 
-uint32_t ra4m1_samba_write_bufferSize() { return 4096; }
+uint32_t ra4m1_samba_write_bufferSize() { return BUFFER_SIZE; }
 
 void ra4m1_samba_init(uart_port_t uartPort, int baud_rate) {
         _self.uartPort = uartPort;
         _self.baud_rate = baud_rate;
 }
 
-void ra4m1_samba_connect() {
+/*
+ * Read a SAM-BA response, returning as soon as either the expected number of
+ * bytes (expected > 0) or the "\n\r" terminator (expected == 0) is received.
+ * The terminator is stripped and the response is NUL-terminated.
+ * Returns the number of bytes read or -1 if the deadline expired.
+ */
+static int _ra4m1_samba_read_response(char *response, size_t size, size_t expected, TickType_t timeout) {
+    TickType_t start = xTaskGetTickCount();
+    size_t num = 0;
+
+    while (num < size - 1) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout ||
+            uart_read_bytes(_self.uartPort, response + num, 1, timeout - elapsed) != 1) {
+            response[num] = '\0';
+            return -1;
+        }
+        num++;
+
+        if (expected) {
+            if (num == expected)
+                break;
+        } else if (num >= RESPONSE_TERMINATOR_LEN &&
+                   memcmp(response + num - RESPONSE_TERMINATOR_LEN, RESPONSE_TERMINATOR, RESPONSE_TERMINATOR_LEN) == 0) {
+            num -= RESPONSE_TERMINATOR_LEN;
+            break;
+        }
+    }
+    response[num] = '\0';
+    return num;
+}
+
+// Wait for a single character acknowledgement ("<ack>\n\r")
+static esp_err_t _ra4m1_samba_read_ack(char ack, TickType_t timeout) {
+    char response[4];
+
+    if (_ra4m1_samba_read_response(response, sizeof(response), 3, timeout) != 3) {
+        ESP_LOGE(TAG, "Timeout waiting for '%c' acknowledgement", ack);
+        return ESP_ERR_TIMEOUT;
+    }
+    if (response[0] != ack)
+        return ESP_FAIL;
+
+    return ESP_OK;
+}
+
+// Send a command and read its (terminated) response
+static int _ra4m1_samba_command(const char *command, char *response, size_t size, TickType_t timeout) {
+    size_t l = strlen(command);
+    if (uart_write_bytes(_self.uartPort, command, l) != l)
+        return -1;
+    return _ra4m1_samba_read_response(response, size, 0, timeout);
+}
+
+// Valid response: non empty printable text (garbage at an unsupported baud rate is not)
+static bool _ra4m1_samba_is_valid_response(const char *response, int num) {
+    if (num <= 0)
+        return false;
+    for (int i = 0; i < num; i++) {
+        if (response[i] < 0x20 || response[i] > 0x7e)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Probe the bootloader with "N#" until it answers (instead of a fixed start delay).
+ * Bytes without terminator mean that the bootloader runs at another baud rate:
+ * give up at once rather than waiting for the deadline.
+ */
+static esp_err_t _ra4m1_samba_wait_ready() {
+    char response[16];
+    int64_t start = esp_timer_get_time();
+    TickType_t deadline = xTaskGetTickCount() + TIMEOUT_READY;
+    int probes = 0;
+
+    do {
+        probes++;
+        int num = _ra4m1_samba_command("N#", response, sizeof(response), PROBE_INTERVAL);
+        if (num >= 0) {
+            if (probes > 1) {
+                // A late reply to the previous probe may still be on its way
+                _ra4m1_samba_read_response(response, sizeof(response), 0, PROBE_INTERVAL);
+                uart_flush_input(_self.uartPort);
+            }
+            ESP_LOGI(TAG, "Bootloader ready after %lld ms (%d probes)", (esp_timer_get_time() - start) / 1000, probes);
+            return ESP_OK;
+        }
+        if (strspn(response, RESPONSE_TERMINATOR) != strlen(response)) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    } while ((int32_t) (deadline - xTaskGetTickCount()) > 0);
+
+    return ESP_ERR_TIMEOUT;
+}
+
+// Enter programming mode and open a SAM-BA session at the given baud rate
+static esp_err_t _ra4m1_samba_connect_at(uint32_t baud_rate) {
     char cmd[256];
-    size_t num;
+    int num;
 
     // Reset RA4M1 and set program mode
     ra4m1_ctrl_enter_programming();
-    vTaskDelay(100 / portTICK_PERIOD_MS); // Wait until samba is ready, 100ms ?
 
-    ESP_ERROR_CHECK(uart_get_baudrate(_self.uartPort, &_self.saved_baud_rate));
-    ESP_ERROR_CHECK(uart_set_baudrate(_self.uartPort, _self.baud_rate));
+    ESP_ERROR_CHECK(uart_set_baudrate(_self.uartPort, baud_rate));
     ESP_ERROR_CHECK(uart_flush(_self.uartPort));
 
-    // Set binary mode (no '>' prompt)
-    uart_write_bytes(_self.uartPort, "N#", 2);
-    uart_read_bytes(_self.uartPort, cmd, sizeof(cmd), TIMEOUT_NORMAL); // Expects "\n\r"
+    // Set binary mode (no '>' prompt), expects "\n\r"
+    esp_err_t err = _ra4m1_samba_wait_ready();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No answer from SAM-BA bootloader at %lu baud", (unsigned long) baud_rate);
+        return err;
+    }
 
     // Get/log ChipId ("nRF52840-QIAA")
-    // FIXME: Check return value ?
-    uart_write_bytes(_self.uartPort, "I#", 2);
-    num = uart_read_bytes(_self.uartPort, cmd, sizeof(cmd), TIMEOUT_NORMAL);
-    cmd[num-2] = '\0'; // remove "\n\r" (-2)
+    num = _ra4m1_samba_command("I#", cmd, sizeof(cmd), TIMEOUT_CMD);
+    if (! _ra4m1_samba_is_valid_response(cmd, num)) {
+        ESP_LOGW(TAG, "Unable to read ChipId at %lu baud", (unsigned long) baud_rate);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
     ESP_LOGI(TAG, "ChipId (%d): %s", num, cmd);
 
     // Get/log bootloader version ("Arduino Bootloader (SAM-BA extended) 2.0 [Arduino:IKXYZ]")
-    uart_write_bytes(_self.uartPort, "V#", 2);
-    num = uart_read_bytes(_self.uartPort, cmd, sizeof(cmd), TIMEOUT_NORMAL);
-    cmd[num-2] = '\0'; // remove "\n\r" (-2)
+    num = _ra4m1_samba_command("V#", cmd, sizeof(cmd), TIMEOUT_CMD);
+    if (! _ra4m1_samba_is_valid_response(cmd, num)) {
+        ESP_LOGW(TAG, "Unable to read bootloader version at %lu baud", (unsigned long) baud_rate);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
     ESP_LOGI(TAG, "Bootloader (%d): %s", num, cmd);
+
+    return ESP_OK;
+}
+
+static uint32_t _ra4m1_samba_load_baudrate() {
+    nvs_handle_t nvs;
+    uint32_t baud_rate = 0;
+    if (nvs_open(NVS_RA4M1_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_u32(nvs, NVS_RA4M1_BAUDRATE, &baud_rate);
+        nvs_close(nvs);
+    }
+    return baud_rate;
+}
+
+/* Save the best baud rate, or clear it (baud_rate 0) */
+static void _ra4m1_samba_save_baudrate(uint32_t baud_rate) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_RA4M1_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        if (baud_rate) {
+            err = nvs_set_u32(nvs, NVS_RA4M1_BAUDRATE, baud_rate);
+        } else {
+            err = nvs_erase_key(nvs, NVS_RA4M1_BAUDRATE);
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                err = ESP_OK;
+            }
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to save SAM-BA baud rate (%s)", esp_err_to_name(err));
+    }
+}
+
+esp_err_t ra4m1_samba_connect() {
+    uint32_t rates[sizeof(_baud_rates) / sizeof(_baud_rates[0]) + 1];
+    size_t num_rates = 0;
+    esp_err_t err = ESP_FAIL;
+
+    ESP_ERROR_CHECK(uart_get_baudrate(_self.uartPort, &_self.saved_baud_rate));
+    _self.slot = 0;
+    _self.is_write_pending = false;
+    _self.is_checksum_supported = true;
+
+    // Best rate found by a previous connection, otherwise probe the higher rates (fastest first)
+    uint32_t stored_rate = _ra4m1_samba_load_baudrate();
+    if (stored_rate > _self.baud_rate && stored_rate <= CONFIG_RA4M1_SAMBA_MAX_BAUDRATE) {
+        rates[num_rates++] = stored_rate;
+    } else {
+        /* Nothing stored (or out of range, e.g. configuration changed) */
+        stored_rate = 0;
+        for (size_t i = 0; i < sizeof(_baud_rates) / sizeof(_baud_rates[0]); i++) {
+            if (_baud_rates[i] > _self.baud_rate && _baud_rates[i] <= CONFIG_RA4M1_SAMBA_MAX_BAUDRATE) {
+                rates[num_rates++] = _baud_rates[i];
+            }
+        }
+    }
+    // Fall back to the default rate
+    rates[num_rates++] = _self.baud_rate;
+
+    for (size_t i = 0; i < num_rates && err != ESP_OK; i++) {
+        err = _ra4m1_samba_connect_at(rates[i]);
+        if (err == ESP_OK) {
+            _self.current_baud_rate = rates[i];
+            ESP_LOGI(TAG, "Connected at %lu baud", (unsigned long) rates[i]);
+            if (rates[i] > _self.baud_rate && rates[i] != stored_rate) {
+                _ra4m1_samba_save_baudrate(rates[i]);
+            }
+        } else if (rates[i] == stored_rate) {
+            /* Probed again by the next connection */
+            ESP_LOGW(TAG, "Stored baud rate %lu failed, cleared", (unsigned long) stored_rate);
+            _ra4m1_samba_save_baudrate(0);
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "No answer from SAM-BA bootloader");
+    }
+    return err;
+}
+
+uint32_t ra4m1_samba_get_baudrate() {
+    return _self.current_baud_rate;
 }
 
 esp_err_t ra4m1_samba_erase(unsigned int start_addr) {
@@ -68,10 +293,38 @@ esp_err_t ra4m1_samba_erase(unsigned int start_addr) {
     int l = snprintf((char*) cmd, sizeof(cmd), "X%08X#", start_addr);
     if (uart_write_bytes(_self.uartPort, cmd, l) != l)
         return ESP_FAIL;
-    uart_read_bytes(_self.uartPort, cmd, 3, TIMEOUT_LONG); // Expects "X\n\r"
-    if (cmd[0] != 'X')
-        return ESP_FAIL;
+    return _ra4m1_samba_read_ack('X', TIMEOUT_LONG); // Expects "X\n\r"
+}
 
+uint16_t ra4m1_samba_crc16(uint16_t crc, const uint8_t *data, size_t len) {
+    // CRC-16/XMODEM (polynomial 0x1021), as computed by the bootloader
+    while (len--) {
+        crc ^= (uint16_t) *data++ << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+esp_err_t ra4m1_samba_checksum(uint32_t addr, uint32_t size, uint16_t *crc) {
+    char cmd[32];
+    unsigned long value;
+
+    if (! _self.is_checksum_supported)
+        return ESP_ERR_NOT_SUPPORTED;
+
+    // Compute the CRC16 of a flash range, expects "Z<crc>#\n\r"
+    snprintf(cmd, sizeof(cmd), "Z%08lX,%08lX#", (unsigned long) addr, (unsigned long) size);
+    if (_ra4m1_samba_command(cmd, cmd, sizeof(cmd), TIMEOUT_NORMAL) < 0 ||
+        sscanf(cmd, "Z%8lx#", &value) != 1) {
+        ESP_LOGW(TAG, "Flash checksum not supported by the bootloader");
+        uart_flush_input(_self.uartPort);
+        _self.is_checksum_supported = false;
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    *crc = (uint16_t) value;
     return ESP_OK;
 }
 
@@ -79,10 +332,13 @@ esp_err_t ra4m1_samba_load_buffer(const uint8_t* buffer, uint32_t size) {
     uint8_t cmd[20];
 
     // Store the data to be written to the flash in the buffer memory
-    snprintf((char*) cmd, sizeof(cmd), "S%08lX,%08lX#", BUFFER_START_ADDRESS, size);
-    if (uart_write_bytes(_self.uartPort, cmd, sizeof(cmd) - 1) != sizeof(cmd) - 1)
+    int l = snprintf((char*) cmd, sizeof(cmd), "S%08lX,%08lX#", BUFFER_SLOT_ADDRESS(_self.slot), size);
+    if (uart_write_bytes(_self.uartPort, cmd, l) != l)
         return ESP_FAIL;
 
+    // Expected CRC of the flash range once written (post-write verification)
+    _self.slot_crc[_self.slot] = ra4m1_samba_crc16(0, buffer, size);
+
     while (size) {
         int written = uart_write_bytes(_self.uartPort, buffer, size);
         if (written == 0)
@@ -94,17 +350,16 @@ esp_err_t ra4m1_samba_load_buffer(const uint8_t* buffer, uint32_t size) {
     return ESP_OK;
 }
 
-esp_err_t ra4m1_samba_write_buffer(uint32_t dst_addr, uint32_t size) {
+// Copy a buffer slot into flash, the write acknowledgement is not read
+static esp_err_t _ra4m1_samba_copy_buffer(unsigned int slot, uint32_t dst_addr, uint32_t size) {
 
     // Set the start address of the buffer to be copied into flash
     uint8_t cmd[20];
-    int l = snprintf((char*) cmd, sizeof(cmd), "Y%08lX,0#", BUFFER_START_ADDRESS);
+    int l = snprintf((char*) cmd, sizeof(cmd), "Y%08lX,0#", BUFFER_SLOT_ADDRESS(slot));
     if (uart_write_bytes(_self.uartPort, cmd, l) != l)
         return ESP_FAIL;
 
-    cmd[0] = 0;
-    uart_read_bytes(_self.uartPort, cmd, 3, TIMEOUT_NORMAL); // Expects "Y\n\r"
-    if (cmd[0] != 'Y')
+    if (_ra4m1_samba_read_ack('Y', TIMEOUT_NORMAL) != ESP_OK) // Expects "Y\n\r"
         return ESP_FAIL;
 
     // Write buffer to flash at dst_addr address
@@ -112,15 +367,72 @@ esp_err_t ra4m1_samba_write_buffer(uint32_t dst_addr, uint32_t size) {
     if (uart_write_bytes(_self.uartPort, cmd, l) != l)
         return ESP_FAIL;
 
-    cmd[0] = 0;
-    uart_read_bytes(_self.uartPort, cmd, 3, TIMEOUT_LONG); // Expects "Y\n\r"
-    if (cmd[0] != 'Y')
-        return ESP_FAIL;
+    return ESP_OK;
+}
+
+// Compare the CRC of a written flash range with the CRC of the data loaded in its slot
+static esp_err_t _ra4m1_samba_verify(uint32_t addr, uint32_t size, unsigned int slot) {
+    uint16_t crc;
 
+    if (ra4m1_samba_checksum(addr, size, &crc) != ESP_OK)
+        return ESP_OK; // Not verifiable
+
+    if (crc != _self.slot_crc[slot]) {
+        ESP_LOGW(TAG, "CRC mismatch at 0x%05lx (0x%04x, expected 0x%04x)", (unsigned long) addr, crc, _self.slot_crc[slot]);
+        return ESP_ERR_INVALID_CRC;
+    }
     return ESP_OK;
 }
 
+esp_err_t ra4m1_samba_sync() {
+    if (! _self.is_write_pending)
+        return ESP_OK;
+
+    _self.is_write_pending = false;
+    esp_err_t err = _ra4m1_samba_read_ack('Y', TIMEOUT_LONG); // Expects "Y\n\r"
+
+    // Verify the written block, the data is still in its slot for a rewrite.
+    // Erasing clears the flash up to its end: blocks are written in ascending
+    // order so only the failing block is rewritten (but never the first block,
+    // written last, whose erase would clear the whole image).
+    for (int retry = 0; err == ESP_OK; retry++) {
+        err = _ra4m1_samba_verify(_self.pending_addr, _self.pending_size, _self.pending_slot);
+        if (err != ESP_ERR_INVALID_CRC || retry == WRITE_RETRIES || _self.pending_addr == 0)
+            break;
+
+        ESP_LOGW(TAG, "Rewriting block at 0x%05lx (%d/%d)", (unsigned long) _self.pending_addr, retry + 1, WRITE_RETRIES);
+        err = ra4m1_samba_erase(_self.pending_addr);
+        if (err == ESP_OK)
+            err = _ra4m1_samba_copy_buffer(_self.pending_slot, _self.pending_addr, _self.pending_size);
+        if (err == ESP_OK)
+            err = _ra4m1_samba_read_ack('Y', TIMEOUT_LONG);
+    }
+    return err;
+}
+
+esp_err_t ra4m1_samba_write_buffer(uint32_t dst_addr, uint32_t size) {
+
+    // Previous write must be complete before the bootloader accepts a new command
+    if (ra4m1_samba_sync() != ESP_OK)
+        return ESP_FAIL;
+
+    if (_ra4m1_samba_copy_buffer(_self.slot, dst_addr, size) != ESP_OK)
+        return ESP_FAIL;
+
+    _self.is_write_pending = true;
+    _self.pending_addr = dst_addr;
+    _self.pending_size = size;
+    _self.pending_slot = _self.slot;
+    _self.slot = (_self.slot + 1) % BUFFER_SLOTS;
+    if (BUFFER_SLOTS > 1) {
+        // Acknowledgement read by the next write (or ra4m1_samba_sync), the next block is loaded meanwhile
+        return ESP_OK;
+    }
+    return ra4m1_samba_sync();
+}
+
 void ra4m1_samba_disconnect() {
+    _self.is_write_pending = false;
     ra4m1_ctrl_exit_programming();
     ESP_ERROR_CHECK(uart_set_baudrate(_self.uartPort, _self.saved_baud_rate));
     ESP_ERROR_CHECK(uart_flush(_self.uartPort));
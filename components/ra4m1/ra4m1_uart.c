@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include "esp_log.h"
 #include "driver/uart.h"
@@ -10,12 +11,22 @@
 #define RA4M1_UART_BUFFER_SIZE (1024 * 2)
 #define RA4M1_UART_EVENT_QUEUE_SIZE 16
 
+// AYAB serial API (SLIP framed messages)
+#define SLIP_END     0xC0
+#define SLIP_ESC     0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+#define AYAB_REQINFO 0x03
+#define AYAB_CNFINFO 0xC3
+#define AYAB_REQINFO_INTERVAL_MS 200 // The firmware may still be starting, the request is repeated
+
 typedef struct {
     int uart_num;                     /*!< UART port number */
     uart_config_t uart_config;       /*!< UART configuration */
     QueueHandle_t event_queue;        /*!< Queue for UART events */
     EventGroupHandle_t event_group;   /*!< Event group for signaling events */
     EventBits_t event_rx;             /*!< Event bit for RX events */    
+    volatile bool is_bridge_enabled;  /*!< Rx/Tx forwarded to the application (disabled during health checks) */
 } srv_ra4m1_uart_data_t;
 
 static const char *TAG = "ra4m1_uart";
@@ -29,6 +40,7 @@ static srv_ra4m1_uart_data_t _self = {
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
         .rx_flow_ctrl_thresh = 122,
     },
+    .is_bridge_enabled = true,
 };
 
 static void _uart_event_task(void *pvParameters) {
@@ -40,7 +52,7 @@ static void _uart_event_task(void *pvParameters) {
             //Rx event -> signal data availability to the main application
             case UART_DATA:
                 // Ignore Rx data while programming
-                if (ra4m1_ctrl_is_programming() == false) {
+                if (ra4m1_ctrl_is_programming() == false && _self.is_bridge_enabled) {
                     xEventGroupSetBits(_self.event_group, _self.event_rx);
                 }
                 break;
@@ -88,7 +100,7 @@ void ra4m1_uart_rx(uart_msg_t *message) {
     *message = (uart_msg_t){.payload=NULL, .len=0};
 
     // Ignore rx request while programming 
-    if (ra4m1_ctrl_is_programming() == false) {
+    if (ra4m1_ctrl_is_programming() == false && _self.is_bridge_enabled) {
         if (uart_get_buffered_data_len(_self.uart_num, &buffer_length) == ESP_OK) {
             if (buffer_length > 0) {
                 message->payload = malloc(buffer_length * sizeof(uint8_t));
@@ -115,7 +127,7 @@ int ra4m1_uart_tx(uart_msg_t *message) {
     int n_bytes = 0;
 
     // Ignore tx request while programming 
-    if (ra4m1_ctrl_is_programming() == false) {
+    if (ra4m1_ctrl_is_programming() == false && _self.is_bridge_enabled) {
         n_bytes = uart_write_bytes(_self.uart_num, message->payload, message->len);
         if (n_bytes < 0) {
             ESP_LOGW(TAG, "Unable to write to uart");
@@ -123,4 +135,59 @@ int ra4m1_uart_tx(uart_msg_t *message) {
     }
 
     return n_bytes;
+}
+
+void ra4m1_uart_set_bridge_enabled(bool enabled) {
+    _self.is_bridge_enabled = enabled;
+}
+
+esp_err_t ra4m1_uart_check_firmware(uint32_t timeout_ms) {
+    const uint8_t request[] = {SLIP_END, AYAB_REQINFO, SLIP_END};
+    uint8_t frame[8];
+    size_t frame_len = 0;
+    bool is_escaped = false;
+    uint8_t c;
+
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+    TickType_t next_request = start;
+
+    uart_flush_input(_self.uart_num);
+    while (xTaskGetTickCount() - start < timeout) {
+        if ((int32_t) (xTaskGetTickCount() - next_request) >= 0) {
+            uart_write_bytes(_self.uart_num, request, sizeof(request));
+            next_request += pdMS_TO_TICKS(AYAB_REQINFO_INTERVAL_MS);
+        }
+        if (uart_read_bytes(_self.uart_num, &c, 1, pdMS_TO_TICKS(10)) != 1) {
+            continue;
+        }
+
+        // SLIP decoding, only the head of each frame is kept
+        if (c == SLIP_END) {
+            if (frame_len >= 5 && frame[0] == AYAB_CNFINFO) {
+                ESP_LOGI(TAG, "AYAB firmware v%u.%u.%u (API %u) answered after %lu ms", frame[2], frame[3], frame[4], frame[1],
+                         (unsigned long) ((xTaskGetTickCount() - start) * portTICK_PERIOD_MS));
+                uart_flush_input(_self.uart_num);
+                return ESP_OK;
+            }
+            frame_len = 0;
+            is_escaped = false;
+            continue;
+        }
+        if (c == SLIP_ESC) {
+            is_escaped = true;
+            continue;
+        }
+        if (is_escaped) {
+            c = (c == SLIP_ESC_END) ? SLIP_END : (c == SLIP_ESC_ESC) ? SLIP_ESC : c;
+            is_escaped = false;
+        }
+        if (frame_len < sizeof(frame)) {
+            frame[frame_len] = c;
+        }
+        frame_len++;
+    }
+
+    ESP_LOGW(TAG, "No answer from AYAB firmware within %lu ms", (unsigned long) timeout_ms);
+    return ESP_ERR_TIMEOUT;
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef _SRV_BUNDLE_H_
+#define _SRV_BUNDLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "srv_index.h"
+
+/**
+ * @brief Label of the partition holding the read-only web asset bundle.
+ */
+#define SRV_BUNDLE_PARTITION_LABEL "assets"
+
+/**
+ * @brief Web asset stored in the bundle (points into memory mapped flash).
+ */
+typedef struct {
+    const char *name;                   /*!< Path relative to the www directory (e.g. "/index.htm") */
+    const uint8_t *data;                /*!< Asset content (gzip compressed when is_gzip is set) */
+    size_t size;                        /*!< Size of data in bytes */
+    bool is_gzip;                       /*!< Content is stored gzip compressed */
+    const char *mime_type;              /*!< MIME type derived from the file extension */
+    char etag[SRV_INDEX_ETAG_SIZE];     /*!< ETag derived from the SHA-256 of the uncompressed content */
+} srv_bundle_file_t;
+
+/**
+ * @brief Map the asset bundle partition and validate its content.
+ *
+ * Does nothing when already mapped.
+ *
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no (valid) bundle.
+ */
+esp_err_t srv_bundle_init(void);
+
+/**
+ * @brief Look up an asset in the bundle.
+ *
+ * @param name Path relative to the www directory (e.g. "/index.htm").
+ * @param file Filled with the asset description when found.
+ * @return true if found, false otherwise (or no bundle mapped).
+ */
+bool srv_bundle_lookup(const char *name, srv_bundle_file_t *file);
+
+#endif
@@ -4,6 +4,18 @@
 #include "esp_http_server.h"
 #include "cJSON.h"
 
+/**
+ * @brief HTTP header carrying the SHA-256 (hex) of an uploaded file.
+ *
+ * Optional on upload requests (upload is rejected on mismatch), always
+ * returned in the upload response.
+ */
+#define SRV_FILE_HDR_SHA256 "X-Content-SHA256"
+
+/**
+ * @brief Suffix of temporary files used while receiving uploads/archives.
+ */
+#define SRV_FILE_TMP_SUFFIX ".tmp"
 
 /**
  * @brief Populate a cJSON object with a list of all files (name, size, url).
@@ -20,6 +32,15 @@ void srv_file_json_list_files(cJSON *list_files);
  */
 esp_err_t srv_file_json_delete_files(cJSON *list_files);
 
+/**
+ * @brief Get the version of the served web assets (from the asset manifest).
+ *
+ * @param version Destination buffer.
+ * @param size    Size of the destination buffer.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no manifest, or another error code.
+ */
+esp_err_t srv_file_get_asset_version(char *version, size_t size);
+
 /**
  * @brief Start the file server and register URI handlers for upload/download.
  *
@@ -0,0 +1,74 @@
+#ifndef _SRV_FIRMWARE_H_
+#define _SRV_FIRMWARE_H_
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "cJSON.h"
+
+/**
+ * @brief Directory of the RA4M1 firmware library (relative to the filesystem root).
+ *
+ * Images are uploaded there as regular files (e.g. /upload/firmware/ayab-1.0.bin),
+ * their metadata is kept in SRV_FIRMWARE_INDEX.
+ */
+#define SRV_FIRMWARE_DIR   "/firmware"
+
+/**
+ * @brief Metadata index of the firmware library (name, size, sha256, version, tag).
+ */
+#define SRV_FIRMWARE_INDEX "index.json"
+
+/**
+ * @brief Progress target reported while flashing an image from the library.
+ */
+#define SRV_FIRMWARE_PROGRESS_TARGET "ra4m1_image"
+
+/**
+ * @brief Initialize the RA4M1 firmware library.
+ *
+ * @param base_path Filesystem mount point (e.g. "/littlefs").
+ * @return ESP_OK on success.
+ */
+esp_err_t srv_firmware_init(const char *base_path);
+
+/**
+ * @brief Populate a cJSON object with the firmware library content.
+ *
+ * The cached index is synchronized with the library directory first (removed
+ * images dropped). New images are hashed by a background task: their sha256 is
+ * empty until then and the "hashing" flag is set. Each image has name, size,
+ * sha256, version, tag and active (image currently in RA4M1 flash) fields.
+ *
+ * @param data cJSON object to fill ("images" array, "busy" and "hashing" flags).
+ */
+void srv_firmware_json_list(cJSON *data);
+
+/**
+ * @brief Flash an image of the library to the RA4M1 ({"name": ...}).
+ *
+ * Flashing runs in background (progress is broadcast over WebSocket) and only
+ * the blocks that differ from the RA4M1 flash content are programmed.
+ *
+ * @param data cJSON object with the image name.
+ * @return ESP_OK if flashing started, ESP_ERR_NOT_FOUND for an unknown image,
+ *         ESP_ERR_INVALID_STATE if the RA4M1 is already being programmed.
+ */
+esp_err_t srv_firmware_json_select(cJSON *data);
+
+/**
+ * @brief Set the version and/or tag of a library image ({"name": ..., "version": ..., "tag": ...}).
+ *
+ * @param data cJSON object with the image name and the metadata to set.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND for an unknown image, or another error code.
+ */
+esp_err_t srv_firmware_json_tag(cJSON *data);
+
+/**
+ * @brief Check whether a library image is being hashed or flashed (files open).
+ *
+ * @return true while the hashing or flashing task runs.
+ */
+bool srv_firmware_is_busy(void);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef _SRV_INDEX_H_
+#define _SRV_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief Maximum length of a file name relative to the filesystem root.
+ */
+#define SRV_INDEX_NAME_MAX  CONFIG_LITTLEFS_OBJ_NAME_LEN
+/**
+ * @brief Size of an ETag string (quoted, NULL terminated).
+ */
+#define SRV_INDEX_ETAG_SIZE 19
+
+/**
+ * @brief File metadata stored in the index.
+ */
+typedef struct {
+    char name[SRV_INDEX_NAME_MAX + 1];  /*!< Path relative to the filesystem root (e.g. "/www/index.htm") */
+    size_t size;                        /*!< File size in bytes */
+    const char *mime_type;              /*!< MIME type derived from the file extension */
+    char etag[SRV_INDEX_ETAG_SIZE];     /*!< ETag derived from the file SHA-256 ("" until known) */
+    bool is_www;                        /*!< File is served from the www directory */
+} srv_index_entry_t;
+
+/**
+ * @brief Callback type for iterating over index entries.
+ *
+ * @param entry Pointer to the entry (only valid during the call).
+ * @param ctx   User context.
+ */
+typedef void (*srv_index_cb_t)(const srv_index_entry_t *entry, void *ctx);
+
+/**
+ * @brief Get the MIME type associated with a file name extension.
+ *
+ * @param filename File name.
+ * @return MIME type ("text/plain" when unknown).
+ */
+const char *srv_index_mime_type(const char *filename);
+
+/**
+ * @brief Initialize the index (creates its mutex).
+ *
+ * Must be called once before any other index function, before the tasks
+ * using the index are started (done by srv_littlefs_start()).
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the mutex cannot be created.
+ */
+esp_err_t srv_index_init(void);
+
+/**
+ * @brief Build the index by scanning the mounted filesystem once.
+ *
+ * @param root_path Filesystem mount point (e.g. "/littlefs").
+ * @param www_path  Path of static web content relative to root_path (e.g. "/www").
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t srv_index_build(const char *root_path, const char *www_path);
+
+/**
+ * @brief Remove all entries from the index (e.g. when the filesystem is unmounted).
+ */
+void srv_index_clear(void);
+
+/**
+ * @brief Look up a file by its name relative to the filesystem root.
+ *
+ * @param name  Relative file name (e.g. "/www/index.htm").
+ * @param entry Destination for a copy of the entry.
+ * @return true if the file is indexed.
+ */
+bool srv_index_lookup(const char *name, srv_index_entry_t *entry);
+
+/**
+ * @brief Add or refresh a file after it has been created or modified.
+ *
+ * @param path   Absolute file path (e.g. "/littlefs/www/index.htm").
+ * @param digest Optional SHA-256 of the file content (NULL if unknown).
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t srv_index_update(const char *path, const uint8_t *digest);
+
+/**
+ * @brief Record the SHA-256 of an indexed file (sets its ETag).
+ *
+ * @param name   Relative file name.
+ * @param digest SHA-256 of the file content.
+ */
+void srv_index_set_digest(const char *name, const uint8_t *digest);
+
+/**
+ * @brief Remove a file from the index after it has been deleted.
+ *
+ * @param path Absolute file path.
+ */
+void srv_index_remove(const char *path);
+
+/**
+ * @brief Iterate over all indexed files.
+ *
+ * @param cb  Callback called for each entry (index is locked during iteration).
+ * @param ctx User context passed to the callback.
+ */
+void srv_index_foreach(srv_index_cb_t cb, void *ctx);
+
+#endif
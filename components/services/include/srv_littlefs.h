@@ -1,7 +1,42 @@
-#ifndef _SRV_SPIFFS_H_
-#define _SRV_SPIFFS_H_
+#ifndef _SRV_LITTLEFS_H_
+#define _SRV_LITTLEFS_H_
+
+#include <stdbool.h>
 
 #include "esp_err.h"
+#include "esp_partition.h"
+
+/**
+ * @brief Labels of the LITTLEFS partitions (A/B slots).
+ *
+ * The active slot is mounted and serves files, file system updates are written
+ * to the other one which is then mounted by srv_littlefs_switch(). Without a
+ * second partition, updates are written to the single (unmounted) partition.
+ */
+#define SRV_LITTLEFS_LABEL_A "littlefs"
+#define SRV_LITTLEFS_LABEL_B "littlefs_b"
+
+/**
+ * @brief Mount point of the updated slot while files are carried over (see srv_littlefs_set_switch_callback()).
+ */
+#define SRV_LITTLEFS_NEXT_PATH "/littlefs_next"
+
+/**
+ * @brief Callback type to carry files over to the updated slot.
+ *
+ * @param base_path Mount point of the updated slot (SRV_LITTLEFS_NEXT_PATH).
+ */
+typedef void (*srv_littlefs_switch_cb_t)(const char *base_path);
+
+/**
+ * @brief Set the callback called by srv_littlefs_switch() before the updated slot becomes active.
+ *
+ * Files that must survive a file system update (e.g. the RA4M1 backup image)
+ * are copied from the active slot to the updated one.
+ *
+ * @param callback Callback (NULL to disable).
+ */
+void srv_littlefs_set_switch_callback(srv_littlefs_switch_cb_t callback);
 
 /**
  * @brief Initialize and mount the LITTLEFS filesystem.
@@ -14,6 +49,33 @@
  */
 esp_err_t srv_littlefs_start(char *base_path);
 
+/**
+ * @brief Get the partition to write a file system update to.
+ *
+ * @return The inactive slot (A/B partitions), or the mounted partition otherwise.
+ */
+const esp_partition_t *srv_littlefs_get_update_partition(void);
+
+/**
+ * @brief Check whether a partition is the mounted file system.
+ *
+ * @param partition LITTLEFS partition.
+ * @return true if the partition is currently mounted.
+ */
+bool srv_littlefs_is_mounted(const esp_partition_t *partition);
+
+/**
+ * @brief Make the updated slot the active one and remount the file system.
+ *
+ * The selection is saved (NVS) once the new slot is mounted, otherwise the
+ * previous slot is remounted. Same as srv_littlefs_restart() without A/B partitions.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE while files of the mounted
+ *         slot may be open (RA4M1 programming, firmware library task), or an
+ *         error code from esp_err_t on failure.
+ */
+esp_err_t srv_littlefs_switch(void);
+
 /**
  * @brief Restart (unmount and remount) the LITTLEFS filesystem.
  *
@@ -0,0 +1,64 @@
+#ifndef _SRV_PROGRESS_H_
+#define _SRV_PROGRESS_H_
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Progress stages.
+ */
+#define SRV_PROGRESS_STAGE_RECEIVE "receive"  /*!< Receiving (and writing) data */
+#define SRV_PROGRESS_STAGE_WRITE   "write"    /*!< Writing pending data */
+#define SRV_PROGRESS_STAGE_VERIFY  "verify"   /*!< Verifying written data */
+#define SRV_PROGRESS_STAGE_COMMIT  "commit"   /*!< Finalizing the update */
+#define SRV_PROGRESS_STAGE_PAUSED  "paused"   /*!< Interrupted, waiting to be resumed */
+#define SRV_PROGRESS_STAGE_DONE    "done"     /*!< Completed (see result) */
+
+/**
+ * @brief Initialize progress reporting (creates its mutex).
+ *
+ * Must be called once before the tasks reporting or sending progress
+ * (OTA, RA4M1 flashing, WebSocket) are started.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the mutex cannot be created.
+ */
+esp_err_t srv_progress_init(void);
+
+/**
+ * @brief Start reporting the progress of an operation (OTA update, RA4M1 flashing, ...).
+ *
+ * Progress is broadcast to all WebSocket clients (JSON_MSG_IND_PROGRESS),
+ * the last state is also sent to clients connecting later on.
+ *
+ * @param target Target of the operation (e.g. "esp32_app", "ra4m1_app").
+ * @param total  Total number of bytes to process (0 if unknown).
+ */
+void srv_progress_begin(const char *target, size_t total);
+
+/**
+ * @brief Report progress (rate limited, except on stage change).
+ *
+ * Can be called from any task.
+ *
+ * @param stage    Current stage (SRV_PROGRESS_STAGE_xxx).
+ * @param received Bytes received so far.
+ * @param written  Bytes written so far.
+ */
+void srv_progress_update(const char *stage, size_t received, size_t written);
+
+/**
+ * @brief Report the end of the operation.
+ *
+ * @param result ESP_OK on success, or an error code.
+ */
+void srv_progress_end(esp_err_t result);
+
+/**
+ * @brief Send the last progress state (if any) to a single WebSocket client.
+ *
+ * @param sockfd Client socket.
+ */
+void srv_progress_send_last(int sockfd);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _SRV_TAR_H_
+#define _SRV_TAR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "cJSON.h"
+
+/**
+ * @brief Opaque streaming tar extractor.
+ */
+typedef struct srv_tar srv_tar_t;
+
+/**
+ * @brief Create a streaming tar (ustar) extractor.
+ *
+ * Regular files are written to <dest_path>/<member name> as data arrives,
+ * each one through a temporary file renamed once complete. Only a single
+ * 512 bytes tar block is buffered.
+ *
+ * @param dest_path Destination directory (must exist).
+ * @param results   cJSON array receiving one {name, size, result} entry per member.
+ * @return Extractor handle or NULL if out of memory.
+ */
+srv_tar_t *srv_tar_create(const char *dest_path, cJSON *results);
+
+/**
+ * @brief Feed tar data to the extractor.
+ *
+ * Errors affecting a single member (e.g. storage full) are reported in
+ * results and don't stop the extraction.
+ *
+ * @param tar  Extractor handle.
+ * @param data Pointer to tar data.
+ * @param len  Length of data in bytes.
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE on a corrupted archive.
+ */
+esp_err_t srv_tar_write(srv_tar_t *tar, const uint8_t *data, size_t len);
+
+/**
+ * @brief Check that the archive has been completely received.
+ *
+ * @param tar Extractor handle.
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the archive is truncated.
+ */
+esp_err_t srv_tar_finish(srv_tar_t *tar);
+
+/**
+ * @brief Release extractor resources (an incomplete member is discarded).
+ *
+ * @param tar Extractor handle (can be NULL).
+ */
+void srv_tar_destroy(srv_tar_t *tar);
+
+#endif
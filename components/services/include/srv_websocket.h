@@ -25,6 +25,13 @@
 #define JSON_MSG_REP_LIST_FILES         (128 + JSON_MSG_REQ_LIST_FILES)
 #define JSON_MSG_REQ_DELETE_FILES       33
 #define JSON_MSG_REP_DELETE_FILES       (128 + JSON_MSG_REQ_DELETE_FILES)
+#define JSON_MSG_REQ_LIST_FIRMWARE      48
+#define JSON_MSG_REP_LIST_FIRMWARE      (128 + JSON_MSG_REQ_LIST_FIRMWARE)
+#define JSON_MSG_REQ_SELECT_FIRMWARE    49
+#define JSON_MSG_REP_SELECT_FIRMWARE    (128 + JSON_MSG_REQ_SELECT_FIRMWARE)
+#define JSON_MSG_REQ_TAG_FIRMWARE       50
+#define JSON_MSG_REP_TAG_FIRMWARE       (128 + JSON_MSG_REQ_TAG_FIRMWARE)
+#define JSON_MSG_IND_PROGRESS           192
 
 /**
  * @brief Send a binary WebSocket message to all connected clients.
@@ -35,6 +42,18 @@
  */
 esp_err_t srv_websocket_send_bin(uint8_t *buffer, uint32_t buffer_length);
 
+/**
+ * @brief Send a JSON message to one or all connected clients.
+ *
+ * Can be called from any task, the message is queued to the HTTP server.
+ *
+ * @param hSocket Client socket, or -1 for all clients.
+ * @param msgId   Message identifier (JSON_MSG_xxx).
+ * @param data    Message data (can be NULL), not taken over.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the server is not running.
+ */
+esp_err_t srv_websocket_send_json_msg(int hSocket, int msgId, cJSON *data);
+
 /**
  * @brief HTTP server handler for incoming WebSocket frames.
  *
@@ -56,4 +75,9 @@ esp_err_t srv_websocket_get_handler(httpd_req_t *req);
  */
 esp_err_t srv_websocket_init(httpd_handle_t server, ws_callback_t ws_rx_bin_callback);
 
+/**
+ * @brief Stop the WebSocket service (no more messages are sent).
+ */
+void srv_websocket_stop();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "srv_bundle.h"
+#include "utils_sha256.h"
+
+/* Bundle layout, see tools/mkbundle.py */
+#define BUNDLE_MAGIC     "AYWB"
+#define BUNDLE_VERSION   1
+#define BUNDLE_NAME_SIZE 64
+#define BUNDLE_FLAG_GZIP 0x1
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t version;
+    uint16_t count;
+    uint32_t size;
+    uint32_t crc32;
+} bundle_header_t;
+
+typedef struct __attribute__((packed)) {
+    char name[BUNDLE_NAME_SIZE];
+    uint32_t offset;
+    uint32_t size;
+    uint32_t flags;
+    uint8_t digest[8];
+} bundle_entry_t;
+
+typedef struct {
+    esp_partition_mmap_handle_t handle;
+    const uint8_t *base;          /*!< Mapped partition */
+    const bundle_entry_t *entries; /*!< Entries sorted by name */
+    size_t count;
+} srv_bundle_data_t;
+
+static const char *TAG = "srv_bundle";
+
+static srv_bundle_data_t _self = {.base = NULL};
+
+static bool _is_valid(const esp_partition_t *partition, const uint8_t *base) {
+    const bundle_header_t *header = (const bundle_header_t *) base;
+    if (memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) || header->version != BUNDLE_VERSION) {
+        ESP_LOGW(TAG, "No asset bundle found");
+        return false;
+    }
+    if (header->size > partition->size ||
+        sizeof(bundle_header_t) + header->count * sizeof(bundle_entry_t) > header->size) {
+        ESP_LOGE(TAG, "Invalid asset bundle size (%lu bytes)", (unsigned long) header->size);
+        return false;
+    }
+    uint32_t crc32 = esp_rom_crc32_le(0, base + sizeof(bundle_header_t), header->size - sizeof(bundle_header_t));
+    if (crc32 != header->crc32) {
+        ESP_LOGE(TAG, "Invalid asset bundle checksum");
+        return false;
+    }
+    const bundle_entry_t *entries = (const bundle_entry_t *) (base + sizeof(bundle_header_t));
+    for (size_t i = 0; i < header->count; i++) {
+        if (entries[i].name[BUNDLE_NAME_SIZE - 1] != '\0' ||
+            entries[i].offset > header->size || entries[i].size > header->size - entries[i].offset) {
+            ESP_LOGE(TAG, "Invalid asset bundle entry %u", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t srv_bundle_init(void) {
+    if (_self.base) {
+        return ESP_OK;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SRV_BUNDLE_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "No '%s' partition", SRV_BUNDLE_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void *base;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &base, &_self.handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map '%s' partition (%s)", SRV_BUNDLE_PARTITION_LABEL, esp_err_to_name(err));
+        return err;
+    }
+    if (!_is_valid(partition, base)) {
+        esp_partition_munmap(_self.handle);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const bundle_header_t *header = (const bundle_header_t *) base;
+    _self.base = base;
+    _self.entries = (const bundle_entry_t *) (_self.base + sizeof(bundle_header_t));
+    _self.count = header->count;
+    ESP_LOGI(TAG, "Asset bundle: %u files, %lu bytes", _self.count, (unsigned long) header->size);
+    return ESP_OK;
+}
+
+bool srv_bundle_lookup(const char *name, srv_bundle_file_t *file) {
+    if (!_self.base) {
+        return false;
+    }
+
+    /* Binary search, entries are sorted by name */
+    size_t low = 0;
+    size_t high = _self.count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const bundle_entry_t *entry = &_self.entries[mid];
+        int cmp = strcmp(name, entry->name);
+        if (cmp == 0) {
+            char hex[UTILS_SHA256_HEX_SIZE];
+            uint8_t digest[UTILS_SHA256_SIZE] = {0};
+            memcpy(digest, entry->digest, sizeof(entry->digest));
+            utils_sha256_to_hex(digest, hex);
+            /* Same format as srv_index ETags */
+            snprintf(file->etag, sizeof(file->etag), "\"%.16s\"", hex);
+            file->name = entry->name;
+            file->data = _self.base + entry->offset;
+            file->size = entry->size;
+            file->is_gzip = (entry->flags & BUNDLE_FLAG_GZIP) != 0;
+            file->mime_type = srv_index_mime_type(entry->name);
+            return true;
+        }
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return false;
+}
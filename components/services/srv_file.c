@@ -13,6 +13,7 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 #include <sys/unistd.h>
@@ -24,20 +25,28 @@
 
 #include "esp_vfs.h"
 #include "esp_littlefs.h"
+#include "mbedtls/sha256.h"
 
+#include "srv_bundle.h"
 #include "srv_file.h"
+#include "srv_index.h"
+#include "srv_tar.h"
+#include "utils_gzip.h"
+#include "utils_sha256.h"
 
 /* Max length a file path can have on storage */
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_LITTLEFS_OBJ_NAME_LEN)
 #define UPLOAD_SCRIPT_HTM "upload_script.htm"
-#define IS_FILE_EXT(filename, ext) \
-    (strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
 
 /* Max size of an individual file. Make sure this
  * value is same as that set in upload_script.html */
 #define MAX_FILE_SIZE   (200*1024) // 200 KB
 #define MAX_FILE_SIZE_STR "200KB"
 
+/* Web asset manifest (generated at build time, see tools/mkmanifest.py) */
+#define ASSET_MANIFEST      "/asset-manifest.json"
+#define ASSET_MANIFEST_MAX  2048
+
 /* Scratch buffer size */
 #define SCRATCH_BUFSIZE  8192
 
@@ -57,27 +66,6 @@ static const char *TAG = "srv_file";
 
 static srv_file_data_t _self = {.is_running=false};
 
-/* Set HTTP response content type according to file extension */
-static esp_err_t _set_content_type_from_file(httpd_req_t *req, const char *filename)
-{
-    if (IS_FILE_EXT(filename, ".pdf")) {
-        return httpd_resp_set_type(req, "application/pdf");
-    } else if (IS_FILE_EXT(filename, ".html") || IS_FILE_EXT(filename, ".htm")) {
-        return httpd_resp_set_type(req, "text/html");
-    } else if (IS_FILE_EXT(filename, ".css")) {
-        return httpd_resp_set_type(req, "text/css");
-    } else if (IS_FILE_EXT(filename, ".js")) {
-        return httpd_resp_set_type(req, "text/javascript");
-    } else if (IS_FILE_EXT(filename, ".jpeg") || IS_FILE_EXT(filename, ".jpg")) {
-        return httpd_resp_set_type(req, "image/jpeg");
-    } else if (IS_FILE_EXT(filename, ".ico")) {
-        return httpd_resp_set_type(req, "image/x-icon");
-    }
-    /* This is a limited set only */
-    /* For any other type always set as plain text */
-    return httpd_resp_set_type(req, "text/plain");
-}
-
 /* Copies the full path into destination buffer and return a pointer to path (without the base path) */
 static const char* _get_path_from_uri(char *dest, const char *base_path, const char *uri, size_t destsize)
 {
@@ -110,9 +98,11 @@ static const char* _get_path_from_uri(char *dest, const char *base_path, const c
     return dest + base_pathlen;
 }
 
-/* Send all file chunks to the request's client. */
-static esp_err_t _send_all_file_chunks(httpd_req_t *req, const char* filepath) {
+/* Send all file chunks to the request's client.
+   File SHA-256 is recorded in the index (ETag) when entry_name is set */
+static esp_err_t _send_all_file_chunks(httpd_req_t *req, const char* filepath, const char *entry_name) {
     FILE *fd = NULL;
+    mbedtls_sha256_context sha256_ctx;
 
     fd = fopen(filepath, "r");
     if (!fd) {
@@ -122,6 +112,11 @@ static esp_err_t _send_all_file_chunks(httpd_req_t *req, const char* filepath) {
         return ESP_FAIL;
     }
 
+    if (entry_name) {
+        mbedtls_sha256_init(&sha256_ctx);
+        mbedtls_sha256_starts(&sha256_ctx, 0);
+    }
+
     /* Retrieve the pointer to scratch buffer for temporary storage */
     char *chunk = _self.scratch;
     size_t chunksize;
@@ -130,9 +125,15 @@ static esp_err_t _send_all_file_chunks(httpd_req_t *req, const char* filepath) {
         chunksize = fread(chunk, 1, SCRATCH_BUFSIZE, fd);
 
         if (chunksize > 0) {
+            if (entry_name) {
+                mbedtls_sha256_update(&sha256_ctx, (const unsigned char *) chunk, chunksize);
+            }
             /* Send the buffer contents as HTTP response chunk */
             if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
                 fclose(fd);
+                if (entry_name) {
+                    mbedtls_sha256_free(&sha256_ctx);
+                }
                 ESP_LOGE(TAG, "File sending failed!");
                 /* Abort sending file */
                 httpd_resp_sendstr_chunk(req, NULL);
@@ -144,16 +145,87 @@ static esp_err_t _send_all_file_chunks(httpd_req_t *req, const char* filepath) {
         /* Keep looping till the whole file is sent */
     } while (chunksize != 0);
 
+    if (entry_name) {
+        uint8_t digest[UTILS_SHA256_SIZE];
+        mbedtls_sha256_finish(&sha256_ctx, digest);
+        mbedtls_sha256_free(&sha256_ctx);
+        if (!ferror(fd)) {
+            srv_index_set_digest(entry_name, digest);
+        }
+    }
+
     /* Close file after sending complete */
     fclose(fd);
     return ESP_OK;
 }
 
+/* Look up a file in the index, falling back to the filesystem for files
+   written behind the index' back */
+static bool _lookup_file(const char *filepath, srv_index_entry_t *entry) {
+    const char *name = filepath + _self.root_path_len;
+    if (srv_index_lookup(name, entry)) {
+        return true;
+    }
+    return (srv_index_update(filepath, NULL) == ESP_OK) && srv_index_lookup(name, entry);
+}
+
+/* Check the If-None-Match request header against an ETag */
+static bool _is_not_modified(httpd_req_t *req, const char *etag) {
+    char if_none_match[SRV_INDEX_ETAG_SIZE];
+    return httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+           !strcmp(if_none_match, etag);
+}
+
+#ifdef CONFIG_WWW_ASSET_BUNDLE
+/* Serve a static asset straight from the memory mapped bundle.
+   The bundle is never rewritten (file uploads, archives and LittleFS updates only
+   change the filesystem): its copy is only served when the filesystem has none
+   (fs_etag NULL) or the same content (same ETag).
+   Returns ESP_ERR_NOT_FOUND when the asset must be served from the filesystem */
+static esp_err_t _send_bundle_file(httpd_req_t *req, const char *filename, const char *fs_etag) {
+    srv_bundle_file_t file;
+    char accept_encoding[64];
+
+    if (!srv_bundle_lookup(filename, &file)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (fs_etag && strcmp(fs_etag, file.etag)) {
+        /* Updated on the filesystem (or not hashed yet, the filesystem copy gets hashed while sent) */
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (file.is_gzip) {
+        /* Fall back to the (uncompressed) filesystem copy for clients without gzip support */
+        if (httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept_encoding, sizeof(accept_encoding)) != ESP_OK ||
+            !strstr(accept_encoding, "gzip")) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    }
+
+    httpd_resp_set_type(req, file.mime_type);
+    httpd_resp_set_hdr(req, "ETag", file.etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (_is_not_modified(req, file.etag)) {
+        ESP_LOGI(TAG, "Bundle file not modified : %s", filename);
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    ESP_LOGI(TAG, "Sending bundle file : %s (%u bytes%s)", filename, file.size, file.is_gzip ? ", gzip" : "");
+#ifdef CONFIG_EXAMPLE_HTTPD_CONN_CLOSE_HEADER
+    httpd_resp_set_hdr(req, "Connection", "close");
+#endif
+    /* Send directly from flash, no scratch buffer copy */
+    return httpd_resp_send(req, (const char *) file.data, file.size);
+}
+#endif
+
 /* Handler to download a file from the file system. */
 static esp_err_t _download_get_handler(httpd_req_t *req)
 {
     char filepath[FILE_PATH_MAX];
-    struct stat file_stat;
+    srv_index_entry_t entry;
 
     const char *filename = _get_path_from_uri(filepath, _self.base_path, req->uri, sizeof(filepath));
     if (!filename) {
@@ -163,20 +235,43 @@ static esp_err_t _download_get_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    if (stat(filepath, &file_stat) == -1) {
+    bool is_found = _lookup_file(filepath, &entry);
+#ifdef CONFIG_WWW_ASSET_BUNDLE
+    esp_err_t err = _send_bundle_file(req, filename, is_found ? entry.etag : NULL);
+    if (err != ESP_ERR_NOT_FOUND) {
+        return err;
+    }
+#endif
+
+    if (!is_found) {
         // Try from root (uri from flash_utils)
         filename = _get_path_from_uri(filepath, _self.root_path, req->uri, sizeof(filepath));
-        if (stat(filepath, &file_stat) == -1) {
-            ESP_LOGE(TAG, "Failed to stat file : %s", filepath);
+        if (!_lookup_file(filepath, &entry)) {
+            ESP_LOGE(TAG, "File not found : %s", filepath);
             /* Respond with 404 Not Found */
             httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
             return ESP_FAIL;
         }
     }
 
-    ESP_LOGI(TAG, "Sending file : %s (%ld bytes)...", filename, file_stat.st_size);
-    _set_content_type_from_file(req, filename);
-    _send_all_file_chunks(req, filepath);
+    httpd_resp_set_type(req, entry.mime_type);
+    if (entry.etag[0]) {
+        /* Let clients revalidate cached copies */
+        httpd_resp_set_hdr(req, "ETag", entry.etag);
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+        if (_is_not_modified(req, entry.etag)) {
+            ESP_LOGI(TAG, "File not modified : %s", filename);
+            httpd_resp_set_status(req, "304 Not Modified");
+            return httpd_resp_send(req, NULL, 0);
+        }
+    }
+
+    ESP_LOGI(TAG, "Sending file : %s (%u bytes)...", filename, entry.size);
+    if (_send_all_file_chunks(req, filepath, entry.etag[0] ? NULL : entry.name) != ESP_OK) {
+        /* File vanished or is unreadable, drop it from the index */
+        srv_index_remove(filepath);
+        return ESP_FAIL;
+    }
 
     /* Respond with an empty chunk to signal HTTP response completion */
 #ifdef CONFIG_EXAMPLE_HTTPD_CONN_CLOSE_HEADER
@@ -187,12 +282,36 @@ static esp_err_t _download_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-/* Handler to upload a file onto the file system. */
+/* Read expected SHA-256 (hex) from the upload request header, if any */
+static esp_err_t _get_upload_digest(httpd_req_t *req, uint8_t *digest, bool *has_digest) {
+    char hex[UTILS_SHA256_HEX_SIZE];
+
+    *has_digest = false;
+    size_t hdr_len = httpd_req_get_hdr_value_len(req, SRV_FILE_HDR_SHA256);
+    if (hdr_len == 0) {
+        return ESP_OK;
+    }
+    if (hdr_len != UTILS_SHA256_HEX_SIZE - 1 ||
+        httpd_req_get_hdr_value_str(req, SRV_FILE_HDR_SHA256, hex, sizeof(hex)) != ESP_OK ||
+        utils_sha256_from_hex(hex, digest) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *has_digest = true;
+    return ESP_OK;
+}
+
+/* Handler to upload a file onto the file system.
+   Data is written to a temporary file while its SHA-256 is computed and only
+   renamed over the target once complete (and matching the client digest) */
 static esp_err_t _upload_post_handler(httpd_req_t *req)
 {
     char filepath[FILE_PATH_MAX];
+    char tmppath[FILE_PATH_MAX];
     FILE *fd = NULL;
-    struct stat file_stat;
+    uint8_t expected_digest[UTILS_SHA256_SIZE];
+    uint8_t digest[UTILS_SHA256_SIZE];
+    char digest_hex[UTILS_SHA256_HEX_SIZE];
+    bool has_digest;
 
     /* Skip leading "/upload" from URI to get filename */
     /* Note sizeof() counts NULL termination hence the -1 */
@@ -211,9 +330,9 @@ static esp_err_t _upload_post_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    if (stat(filepath, &file_stat) == 0) {
-        ESP_LOGW(TAG, "Deleting already existing file : %s", filepath);
-        unlink(filepath);
+    if (snprintf(tmppath, sizeof(tmppath), "%s" SRV_FILE_TMP_SUFFIX, filepath) >= sizeof(tmppath)) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return ESP_FAIL;
     }
 
     /* File cannot be larger than a limit */
@@ -228,9 +347,15 @@ static esp_err_t _upload_post_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    fd = fopen(filepath, "w");
+    if (_get_upload_digest(req, expected_digest, &has_digest) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid " SRV_FILE_HDR_SHA256 " header");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid " SRV_FILE_HDR_SHA256 " header");
+        return ESP_FAIL;
+    }
+
+    fd = fopen(tmppath, "w");
     if (!fd) {
-        ESP_LOGE(TAG, "Failed to create file : %s", filepath);
+        ESP_LOGE(TAG, "Failed to create file : %s", tmppath);
         /* Respond with 500 Internal Server Error */
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
         return ESP_FAIL;
@@ -238,6 +363,10 @@ static esp_err_t _upload_post_handler(httpd_req_t *req)
 
     ESP_LOGI(TAG, "Receiving file : %s...", filename);
 
+    mbedtls_sha256_context sha256_ctx;
+    mbedtls_sha256_init(&sha256_ctx);
+    mbedtls_sha256_starts(&sha256_ctx, 0);
+
     /* Retrieve the pointer to scratch buffer for temporary storage */
     char *buf = _self.scratch;
     int received;
@@ -257,9 +386,10 @@ static esp_err_t _upload_post_handler(httpd_req_t *req)
             }
 
             /* In case of unrecoverable error,
-             * close and delete the unfinished file*/
+             * close and delete the unfinished file (target is left untouched) */
             fclose(fd);
-            unlink(filepath);
+            unlink(tmppath);
+            mbedtls_sha256_free(&sha256_ctx);
 
             ESP_LOGE(TAG, "File reception failed!");
             /* Respond with 500 Internal Server Error */
@@ -272,13 +402,15 @@ static esp_err_t _upload_post_handler(httpd_req_t *req)
             /* Couldn't write everything to file!
              * Storage may be full? */
             fclose(fd);
-            unlink(filepath);
+            unlink(tmppath);
+            mbedtls_sha256_free(&sha256_ctx);
 
             ESP_LOGE(TAG, "File write failed!");
             /* Respond with 500 Internal Server Error */
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
             return ESP_FAIL;
         }
+        mbedtls_sha256_update(&sha256_ctx, (const unsigned char *) buf, received);
 
         /* Keep track of remaining size of
          * the file left to be uploaded */
@@ -286,68 +418,235 @@ static esp_err_t _upload_post_handler(httpd_req_t *req)
     }
 
     /* Close file upon upload completion */
-    fclose(fd);
-    ESP_LOGI(TAG, "File reception complete");
+    mbedtls_sha256_finish(&sha256_ctx, digest);
+    mbedtls_sha256_free(&sha256_ctx);
+    utils_sha256_to_hex(digest, digest_hex);
+    if (fclose(fd) != 0) {
+        unlink(tmppath);
+        ESP_LOGE(TAG, "File write failed!");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        return ESP_FAIL;
+    }
+
+    if (has_digest && memcmp(digest, expected_digest, sizeof(digest)) != 0) {
+        unlink(tmppath);
+        ESP_LOGE(TAG, "File digest mismatch (sha256=%s)", digest_hex);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "File digest mismatch");
+        return ESP_FAIL;
+    }
+
+    /* Atomically replace the existing file (if any) */
+    if (rename(tmppath, filepath) != 0) {
+        unlink(tmppath);
+        ESP_LOGE(TAG, "Failed to rename %s", tmppath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        return ESP_FAIL;
+    }
+    srv_index_update(filepath, digest);
+    ESP_LOGI(TAG, "File reception complete (sha256=%s)", digest_hex);
 
     /* Redirect onto flash_utils to see the updated file list */
     //httpd_resp_set_status(req, "303 See Other");
     //httpd_resp_set_hdr(req, "Location", "/flash_utils   ");
     //httpd_resp_sendstr(req, "File uploaded successfully");
+    httpd_resp_set_hdr(req, SRV_FILE_HDR_SHA256, digest_hex);
     httpd_resp_send(req, "File uploaded successfully", HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
 }
 
-// Populate JSON data with list of all files in a directory (name, size, [url])
-void srv_file_json_list_dir(char *entrypath, cJSON *json_entries) {
-    struct dirent *entry;
-    struct stat entry_stat;
+/* Forward decompressed archive data to the tar extractor */
+static esp_err_t _archive_gzip_output(void *ctx, const uint8_t *data, size_t len) {
+    return srv_tar_write((srv_tar_t *) ctx, data, len);
+}
+
+/* Handler to extract a (gzip compressed) tar archive onto the file system.
+   Members are written as they arrive, i.e. without staging the archive */
+static esp_err_t _archive_post_handler(httpd_req_t *req)
+{
+    char dirpath[FILE_PATH_MAX];
+    utils_gzip_t *gzip = NULL;
+    esp_err_t err = ESP_OK;
+
+    /* Skip leading "/archive" from URI to get destination directory */
+    const char *dirname = _get_path_from_uri(dirpath, _self.root_path,
+                                            req->uri + sizeof("/archive") - 1, sizeof(dirpath));
+    if (!dirname) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Path too long");
+        return ESP_FAIL;
+    }
+    /* Remove trailing '/' */
+    size_t dirpath_len = strlen(dirpath);
+    while (dirpath_len > _self.root_path_len && dirpath[dirpath_len - 1] == '/') {
+        dirpath[--dirpath_len] = '\0';
+    }
 
-    DIR *dir = opendir(entrypath);
-    if (!dir) {
-        ESP_LOGE(TAG, "Failed to open %s directory", entrypath);
-        return;
+    cJSON *reply = cJSON_CreateObject();
+    cJSON *files = cJSON_AddArrayToObject(reply, "files");
+    srv_tar_t *tar = srv_tar_create(dirpath, files);
+    if (tar == NULL) {
+        cJSON_Delete(reply);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to allocate memory");
+        return ESP_FAIL;
     }
 
-    /* Iterate over all files / folders and fetch their names and sizes */
-    size_t entry_path_len = strlen(entrypath);
-    while ((entry = readdir(dir)) != NULL) {
-        strlcat(entrypath, entry->d_name, FILE_PATH_MAX -1);
-        if (stat(entrypath, &entry_stat) == -1) {
-            ESP_LOGE(TAG, "Failed to stat : %s", entry->d_name);
-            continue;
+    ESP_LOGI(TAG, "Extracting archive (%d bytes) into %s", req->content_len, dirpath);
+
+    char *buf = _self.scratch;
+    int received;
+    int remaining = req->content_len;
+    bool first_chunk = true;
+    while ((remaining > 0) && (err == ESP_OK)) {
+        if ((received = httpd_req_recv(req, buf, MIN(remaining, SCRATCH_BUFSIZE))) <= 0) {
+            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+                /* Retry if timeout occurred */
+                continue;
+            }
+            ESP_LOGE(TAG, "Archive reception failed!");
+            err = ESP_FAIL;
+            break;
         }
-        if (S_ISDIR(entry_stat.st_mode)) {
-            /* Entry is a directory, add '/' to the end of the name and
-             * recursively list the directory */
-            strlcat(entrypath, "/", FILE_PATH_MAX -1);
-            srv_file_json_list_dir(entrypath, json_entries);   
+        /* Detect compressed archives from the gzip magic bytes */
+        if (first_chunk) {
+            first_chunk = false;
+            if (utils_gzip_is_gzip((uint8_t *) buf, received)) {
+                gzip = utils_gzip_create(_archive_gzip_output, tar);
+                if (gzip == NULL) {
+                    err = ESP_ERR_NO_MEM;
+                    break;
+                }
+            }
+        }
+        err = gzip ? utils_gzip_write(gzip, (uint8_t *) buf, received)
+                   : srv_tar_write(tar, (uint8_t *) buf, received);
+        remaining -= received;
+    }
+
+    if (err == ESP_OK && gzip) {
+        err = utils_gzip_finish(gzip);
+    }
+    if (err == ESP_OK) {
+        err = srv_tar_finish(tar);
+    }
+    utils_gzip_destroy(gzip);
+    srv_tar_destroy(tar);
+
+    if (err == ESP_FAIL) {
+        cJSON_Delete(reply);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive archive");
+        return ESP_FAIL;
+    }
+
+    /* Report per-file results (archive errors don't roll back completed files) */
+    ESP_LOGI(TAG, "Archive extraction complete (%s)", esp_err_to_name(err));
+    cJSON_AddNumberToObject(reply, "result", err);
+    char *reply_str = cJSON_PrintUnformatted(reply);
+    cJSON_Delete(reply);
+    if (reply_str == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to allocate memory");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, reply_str);
+    free(reply_str);
+    return ESP_OK;
+}
+
+/* Add an index entry to JSON data (name, size, [url]) */
+static void _json_add_entry(const srv_index_entry_t *entry, void *ctx) {
+    cJSON *json_entries = (cJSON *) ctx;
+    cJSON *json_entry = cJSON_CreateObject();
+    cJSON_AddItemToArray(json_entries, json_entry);
+    cJSON_AddStringToObject(json_entry, "name", entry->name);
+    cJSON_AddNumberToObject(json_entry, "size", entry->size);
+    if (entry->is_www) {
+        cJSON_AddStringToObject(json_entry, "url" , entry->name + (_self.base_path_len - _self.root_path_len));
+    }
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} _asset_buffer_t;
+
+static esp_err_t _asset_buffer_write(void *ctx, const uint8_t *data, size_t len) {
+    _asset_buffer_t *buffer = ctx;
+    if (buffer->len + len >= buffer->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return ESP_OK;
+}
+
+/* Read a small web asset (NULL terminated), from the bundle when the filesystem has no copy */
+static esp_err_t _read_asset(const char *name, _asset_buffer_t *buffer) {
+    esp_err_t err;
+    buffer->len = 0;
+
+    char filepath[FILE_PATH_MAX];
+    snprintf(filepath, sizeof(filepath), "%s%s", _self.base_path, name);
+    FILE *fd = fopen(filepath, "r");
+    if (fd) {
+        buffer->len = fread(buffer->data, 1, buffer->size - 1, fd);
+        err = ferror(fd) ? ESP_FAIL : ESP_OK;
+        fclose(fd);
+        buffer->data[buffer->len] = '\0';
+        return err;
+    }
+#ifdef CONFIG_WWW_ASSET_BUNDLE
+    srv_bundle_file_t file;
+    if (srv_bundle_lookup(name, &file)) {
+        if (!file.is_gzip) {
+            err = _asset_buffer_write(buffer, file.data, file.size);
+        } else {
+            utils_gzip_t *gzip = utils_gzip_create(_asset_buffer_write, buffer);
+            if (gzip == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+            err = utils_gzip_write(gzip, file.data, file.size);
+            if (err == ESP_OK) {
+                err = utils_gzip_finish(gzip);
+            }
+            utils_gzip_destroy(gzip);
+        }
+        buffer->data[buffer->len] = '\0';
+        return err;
+    }
+#endif
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t srv_file_get_asset_version(char *version, size_t size) {
+    _asset_buffer_t buffer = {.size = ASSET_MANIFEST_MAX};
+    buffer.data = malloc(buffer.size);
+    if (buffer.data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = _read_asset(ASSET_MANIFEST, &buffer);
+    if (err == ESP_OK) {
+        cJSON *manifest = cJSON_Parse(buffer.data);
+        const cJSON *manifest_version = cJSON_GetObjectItemCaseSensitive(manifest, "version");
+        if (cJSON_IsString(manifest_version) && (manifest_version->valuestring != NULL)) {
+            strlcpy(version, manifest_version->valuestring, size);
         } else {
-            /* Entry is a file, build JSON dictionnary for this entry */
-            cJSON *json_entry = cJSON_CreateObject();
-            cJSON_AddItemToArray(json_entries, json_entry);
-            cJSON_AddStringToObject(json_entry, "name", entrypath+_self.root_path_len);
-            cJSON_AddNumberToObject(json_entry, "size", entry_stat.st_size);
-            if (!strncmp(_self.base_path, entrypath, _self.base_path_len)) {
-                cJSON_AddStringToObject(json_entry, "url" , entrypath+_self.base_path_len);
-            }            
+            ESP_LOGW(TAG, "Invalid asset manifest");
+            err = ESP_ERR_INVALID_RESPONSE;
         }
-        entrypath[entry_path_len] = 0; // Reset to parent path
+        cJSON_Delete(manifest);
     }
-    closedir(dir);
+    free(buffer.data);
+    return err;
 }
 
 // Populate JSON data with list of all files on the file system
 void srv_file_json_list_files(cJSON *list_files) {
-    char entrypath[FILE_PATH_MAX];
-
     // FIXME: Add error handling ...
     cJSON *json_entries = cJSON_CreateArray();
     cJSON_AddItemToObject(list_files, "list_files", json_entries);
 
-    /* Start from root directory */
-    snprintf(entrypath, FILE_PATH_MAX, "%s/", _self.root_path);
-
-    srv_file_json_list_dir(entrypath, json_entries);
+    srv_index_foreach(_json_add_entry, json_entries);
 }
 
 /* Delete file listed in JSON data*/
@@ -373,6 +672,7 @@ esp_err_t srv_file_json_delete_files(cJSON *list_files) {
         ESP_LOGI(TAG, "Deleting file : %s", filename);
         /* Delete file */
         unlink(filepath);
+        srv_index_remove(filepath);
     }
     return ESP_OK;
 }
@@ -392,6 +692,11 @@ esp_err_t srv_file_start(httpd_handle_t server, const char *base_path, const cha
     _self.base_path_len = strlen(_self.base_path);
     _self.root_path_len = strlen(_self.root_path);
 
+#ifdef CONFIG_WWW_ASSET_BUNDLE
+    /* Static assets are served from the bundle when available */
+    srv_bundle_init();
+#endif
+
     /* URI handler for uploading files to server */
     httpd_uri_t file_upload = {
         .uri       = "/upload/*",     // Match all URIs of type /upload/path/to/file
@@ -401,6 +706,15 @@ esp_err_t srv_file_start(httpd_handle_t server, const char *base_path, const cha
     };
     httpd_register_uri_handler(server, &file_upload);
 
+    /* URI handler for extracting (.tar/.tar.gz) archives */
+    httpd_uri_t archive_upload = {
+        .uri       = "/archive/*",    // Match all URIs of type /archive/path/to/directory
+        .method    = HTTP_POST,
+        .handler   = _archive_post_handler,
+        .user_ctx  = NULL
+    };
+    httpd_register_uri_handler(server, &archive_upload);
+
     /* URI handler for getting uploaded files */
     httpd_uri_t file_download = {
         .uri       = "/*",            // Match all URIs of type /path/to/file
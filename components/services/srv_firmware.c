@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_vfs.h"
+
+#include "ra4m1_flash.h"
+#include "srv_file.h"
+#include "srv_firmware.h"
+#include "srv_index.h"
+#include "srv_progress.h"
+#include "utils_sha256.h"
+
+#define FIRMWARE_PATH_MAX    (ESP_VFS_PATH_MAX + CONFIG_LITTLEFS_OBJ_NAME_LEN + sizeof(SRV_FIRMWARE_DIR) + 1)
+#define FIRMWARE_INDEX_MAX   (8 * 1024)   /*!< Maximum size of the index file */
+#define FIRMWARE_TASK_STACK  4096
+#define FIRMWARE_TASK_PRIORITY 4
+#define FIRMWARE_HASH_TASK_STACK    4096
+#define FIRMWARE_HASH_TASK_PRIORITY 2   /*!< Below the HTTP server */
+
+/* Index being saved or file being uploaded */
+#define IS_TMP_FILE(name) \
+    (strlen(name) >= sizeof(SRV_FILE_TMP_SUFFIX) && strcmp(&(name)[strlen(name) - sizeof(SRV_FILE_TMP_SUFFIX) + 1], SRV_FILE_TMP_SUFFIX) == 0)
+
+typedef struct {
+    char base_path[ESP_VFS_PATH_MAX + 1];
+    TaskHandle_t task;                    /*!< Background flashing task (NULL when idle) */
+    TaskHandle_t hash_task;               /*!< Background hashing task (NULL when idle) */
+    SemaphoreHandle_t lock;               /*!< Protects the index file and the task handles */
+} srv_firmware_data_t;
+
+static const char *TAG = "srv_firmware";
+
+static srv_firmware_data_t _self;
+
+/* Build the path of a library file, NULL for names that are not plain file names */
+static const char *_get_path(char *path, size_t size, const char *name) {
+    if (name == NULL || *name == '\0' || strchr(name, '/') || strcmp(name, "..") == 0 || strcmp(name, ".") == 0) {
+        return NULL;
+    }
+    if (snprintf(path, size, "%s" SRV_FIRMWARE_DIR "/%s", _self.base_path, name) >= size) {
+        return NULL;
+    }
+    return path;
+}
+
+/* Load the index (empty when missing or invalid) */
+static cJSON *_load_index(void) {
+    char path[FIRMWARE_PATH_MAX];
+    cJSON *index = NULL;
+
+    _get_path(path, sizeof(path), SRV_FIRMWARE_INDEX);
+    FILE *fd = fopen(path, "r");
+    if (fd) {
+        char *buffer = malloc(FIRMWARE_INDEX_MAX);
+        if (buffer) {
+            size_t len = fread(buffer, 1, FIRMWARE_INDEX_MAX - 1, fd);
+            buffer[len] = '\0';
+            index = cJSON_Parse(buffer);
+            free(buffer);
+        }
+        fclose(fd);
+    }
+    if (! cJSON_IsArray(cJSON_GetObjectItemCaseSensitive(index, "images"))) {
+        if (fd) {
+            ESP_LOGW(TAG, "Invalid firmware index, rebuilding it");
+        }
+        cJSON_Delete(index);
+        index = cJSON_CreateObject();
+        cJSON_AddItemToObject(index, "images", cJSON_CreateArray());
+    }
+    return index;
+}
+
+/* Written to a temporary file then renamed, the previous index is kept on failure */
+static esp_err_t _save_index(cJSON *index) {
+    char path[FIRMWARE_PATH_MAX];
+    char tmppath[FIRMWARE_PATH_MAX + sizeof(SRV_FILE_TMP_SUFFIX)];
+    esp_err_t err = ESP_FAIL;
+
+    char *json_str = cJSON_Print(index);
+    if (json_str == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    _get_path(path, sizeof(path), SRV_FIRMWARE_INDEX);
+    snprintf(tmppath, sizeof(tmppath), "%s" SRV_FILE_TMP_SUFFIX, path);
+    FILE *fd = fopen(tmppath, "w");
+    if (fd) {
+        size_t len = strlen(json_str);
+        err = (fwrite(json_str, 1, len, fd) == len) ? ESP_OK : ESP_FAIL;
+        if (fclose(fd) != 0) {
+            err = ESP_FAIL;
+        }
+        if (err == ESP_OK && rename(tmppath, path) != 0) {
+            err = ESP_FAIL;
+        }
+        if (err != ESP_OK) {
+            unlink(tmppath);
+        } else {
+            srv_index_update(path, NULL);
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to save firmware index");
+    }
+    free(json_str);
+    return err;
+}
+
+static cJSON *_find_image(cJSON *index, const char *name) {
+    cJSON *image;
+    cJSON_ArrayForEach(image, cJSON_GetObjectItemCaseSensitive(index, "images")) {
+        const cJSON *image_name = cJSON_GetObjectItemCaseSensitive(image, "name");
+        if (cJSON_IsString(image_name) && strcmp(image_name->valuestring, name) == 0) {
+            return image;
+        }
+    }
+    return NULL;
+}
+
+static void _set_string(cJSON *object, const char *key, const char *value) {
+    if (cJSON_GetObjectItemCaseSensitive(object, key)) {
+        cJSON_ReplaceItemInObjectCaseSensitive(object, key, cJSON_CreateString(value));
+    } else {
+        cJSON_AddStringToObject(object, key, value);
+    }
+}
+
+/* Synchronize the index with the library directory (index locked).
+   Only file sizes are checked: new (or replaced) images are hashed by _hash_task.
+   Returns true if some image is not hashed yet */
+static bool _sync_index(cJSON *index) {
+    char path[FIRMWARE_PATH_MAX];
+    struct dirent *entry;
+    struct stat entry_stat;
+    bool is_modified = false;
+    bool is_pending = false;
+    cJSON *images = cJSON_GetObjectItemCaseSensitive(index, "images");
+
+    snprintf(path, sizeof(path), "%s" SRV_FIRMWARE_DIR, _self.base_path);
+    DIR *dir = opendir(path);
+    if (dir) {
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, SRV_FIRMWARE_INDEX) == 0 || IS_TMP_FILE(entry->d_name) ||
+                _get_path(path, sizeof(path), entry->d_name) == NULL ||
+                stat(path, &entry_stat) == -1 || ! S_ISREG(entry_stat.st_mode)) {
+                continue;
+            }
+            cJSON *image = _find_image(index, entry->d_name);
+            const cJSON *size = cJSON_GetObjectItemCaseSensitive(image, "size");
+            if (image && cJSON_IsNumber(size) && size->valuedouble == entry_stat.st_size) {
+                continue;
+            }
+
+            /* New (or replaced) image, hashed in background */
+            if (image == NULL) {
+                image = cJSON_CreateObject();
+                cJSON_AddStringToObject(image, "name", entry->d_name);
+                cJSON_AddStringToObject(image, "version", "");
+                cJSON_AddStringToObject(image, "tag", "");
+                cJSON_AddItemToArray(images, image);
+            }
+            cJSON_DeleteItemFromObjectCaseSensitive(image, "size");
+            cJSON_AddNumberToObject(image, "size", entry_stat.st_size);
+            _set_string(image, "sha256", "");
+            ESP_LOGI(TAG, "Firmware image %s added (%ld bytes)", entry->d_name, (long) entry_stat.st_size);
+            is_modified = true;
+        }
+        closedir(dir);
+    }
+
+    /* Drop images whose file was deleted */
+    for (int i = cJSON_GetArraySize(images) - 1; i >= 0; i--) {
+        const cJSON *image_name = cJSON_GetObjectItemCaseSensitive(cJSON_GetArrayItem(images, i), "name");
+        if (! cJSON_IsString(image_name) ||
+            _get_path(path, sizeof(path), image_name->valuestring) == NULL ||
+            stat(path, &entry_stat) == -1) {
+            cJSON_DeleteItemFromArray(images, i);
+            is_modified = true;
+        }
+    }
+
+    if (is_modified) {
+        _save_index(index);
+    }
+
+    cJSON *image;
+    cJSON_ArrayForEach(image, images) {
+        const cJSON *sha256 = cJSON_GetObjectItemCaseSensitive(image, "sha256");
+        is_pending |= ! cJSON_IsString(sha256) || sha256->valuestring[0] == '\0';
+    }
+    return is_pending;
+}
+
+/* Name of the next image to hash (index locked), false if none */
+static bool _next_image_to_hash(char *name, size_t size) {
+    bool is_found = false;
+    cJSON *index = _load_index();
+    cJSON *image;
+    cJSON_ArrayForEach(image, cJSON_GetObjectItemCaseSensitive(index, "images")) {
+        const cJSON *image_name = cJSON_GetObjectItemCaseSensitive(image, "name");
+        const cJSON *sha256 = cJSON_GetObjectItemCaseSensitive(image, "sha256");
+        if (cJSON_IsString(image_name) && (! cJSON_IsString(sha256) || sha256->valuestring[0] == '\0')) {
+            strlcpy(name, image_name->valuestring, size);
+            is_found = true;
+            break;
+        }
+    }
+    cJSON_Delete(index);
+    return is_found;
+}
+
+/* Hash new images out of the HTTP server task (up to 256 KB each) */
+static void _hash_task(void *pvParameters) {
+    char name[CONFIG_LITTLEFS_OBJ_NAME_LEN + 1];
+    char path[FIRMWARE_PATH_MAX];
+    uint8_t digest[UTILS_SHA256_SIZE];
+    char digest_hex[UTILS_SHA256_HEX_SIZE];
+    size_t image_size;
+
+    while (true) {
+        xSemaphoreTake(_self.lock, portMAX_DELAY);
+        bool is_found = _next_image_to_hash(name, sizeof(name));
+        xSemaphoreGive(_self.lock);
+        if (! is_found) {
+            break;
+        }
+
+        esp_err_t err = (_get_path(path, sizeof(path), name) != NULL) ? utils_sha256_file(path, digest, &image_size) : ESP_ERR_NOT_FOUND;
+
+        xSemaphoreTake(_self.lock, portMAX_DELAY);
+        cJSON *index = _load_index();
+        cJSON *image = _find_image(index, name);
+        const cJSON *size = cJSON_GetObjectItemCaseSensitive(image, "size");
+        if (err == ESP_OK && cJSON_IsNumber(size) && size->valuedouble == image_size) {
+            utils_sha256_to_hex(digest, digest_hex);
+            _set_string(image, "sha256", digest_hex);
+            _save_index(index);
+            ESP_LOGI(TAG, "Firmware image %s hashed", name);
+        } else if (err != ESP_OK) {
+            /* Removed meanwhile or unreadable, left to the next synchronization */
+            ESP_LOGW(TAG, "Unable to hash firmware image %s", name);
+        }
+        cJSON_Delete(index);
+        xSemaphoreGive(_self.lock);
+        if (err != ESP_OK) {
+            break;
+        }
+    }
+
+    xSemaphoreTake(_self.lock, portMAX_DELAY);
+    _self.hash_task = NULL;
+    xSemaphoreGive(_self.lock);
+    vTaskDelete(NULL);
+}
+
+/* Start hashing new images (index locked) */
+static void _start_hash_task(void) {
+    if (_self.hash_task == NULL &&
+        xTaskCreate(_hash_task, "firmware_hash", FIRMWARE_HASH_TASK_STACK, NULL, FIRMWARE_HASH_TASK_PRIORITY, &_self.hash_task) != pdPASS) {
+        _self.hash_task = NULL;
+        ESP_LOGE(TAG, "Unable to start firmware hashing task");
+    }
+}
+
+static void _flash_task(void *pvParameters) {
+    char *path = pvParameters;
+    struct stat st;
+
+    srv_progress_begin(SRV_FIRMWARE_PROGRESS_TARGET, (stat(path, &st) == 0) ? st.st_size : 0);
+    esp_err_t err = ra4m1_flash_image(path);
+    srv_progress_end(err);
+    ESP_LOGI(TAG, "Flashing %s %s", path, (err == ESP_OK) ? "succeeded" : "failed");
+
+    free(path);
+    xSemaphoreTake(_self.lock, portMAX_DELAY);
+    _self.task = NULL;
+    xSemaphoreGive(_self.lock);
+    vTaskDelete(NULL);
+}
+
+esp_err_t srv_firmware_init(const char *base_path) {
+    char path[FIRMWARE_PATH_MAX];
+
+    if (_self.lock == NULL) {
+        _self.lock = xSemaphoreCreateMutex();
+        if (_self.lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    strlcpy(_self.base_path, base_path, sizeof(_self.base_path));
+    snprintf(path, sizeof(path), "%s" SRV_FIRMWARE_DIR, _self.base_path);
+    mkdir(path, 0755);
+    return ESP_OK;
+}
+
+void srv_firmware_json_list(cJSON *data) {
+    uint8_t active_digest[UTILS_SHA256_SIZE];
+    char active_hex[UTILS_SHA256_HEX_SIZE] = "";
+    uint32_t active_size;
+
+    /* Cached index, new images are hashed in background */
+    xSemaphoreTake(_self.lock, portMAX_DELAY);
+    cJSON *index = _load_index();
+    if (_sync_index(index)) {
+        _start_hash_task();
+    }
+    bool is_hashing = (_self.hash_task != NULL);
+    bool is_busy = (_self.task != NULL);
+    xSemaphoreGive(_self.lock);
+
+    if (ra4m1_flash_get_image_info(active_digest, &active_size) == ESP_OK) {
+        utils_sha256_to_hex(active_digest, active_hex);
+    }
+
+    cJSON *images = cJSON_DetachItemFromObjectCaseSensitive(index, "images");
+    cJSON *image;
+    cJSON_ArrayForEach(image, images) {
+        const cJSON *sha256 = cJSON_GetObjectItemCaseSensitive(image, "sha256");
+        cJSON_AddBoolToObject(image, "active", active_hex[0] != '\0' && cJSON_IsString(sha256) && strcasecmp(sha256->valuestring, active_hex) == 0);
+    }
+    cJSON_AddItemToObject(data, "images", images);
+    cJSON_AddBoolToObject(data, "busy", is_busy || ra4m1_flash_is_busy());
+    cJSON_AddBoolToObject(data, "hashing", is_hashing);
+    cJSON_Delete(index);
+}
+
+esp_err_t srv_firmware_json_select(cJSON *data) {
+    char path[FIRMWARE_PATH_MAX];
+    struct stat st;
+
+    const cJSON *name = cJSON_GetObjectItemCaseSensitive(data, "name");
+    if (! cJSON_IsString(name) || _get_path(path, sizeof(path), name->valuestring) == NULL ||
+        strcmp(name->valuestring, SRV_FIRMWARE_INDEX) == 0 || stat(path, &st) == -1) {
+        ESP_LOGW(TAG, "Unknown firmware image");
+        return ESP_ERR_NOT_FOUND;
+    }
+    char *task_path = strdup(path);
+    if (task_path == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(_self.lock, portMAX_DELAY);
+    if (_self.task != NULL || ra4m1_flash_is_busy()) {
+        ESP_LOGW(TAG, "RA4M1 programming already in progress");
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        ESP_LOGI(TAG, "Flashing firmware image %s", name->valuestring);
+        if (xTaskCreate(_flash_task, "firmware_task", FIRMWARE_TASK_STACK, task_path, FIRMWARE_TASK_PRIORITY, &_self.task) != pdPASS) {
+            _self.task = NULL;
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    xSemaphoreGive(_self.lock);
+    if (err != ESP_OK) {
+        free(task_path);
+    }
+    return err;
+}
+
+esp_err_t srv_firmware_json_tag(cJSON *data) {
+    const char *keys[] = {"version", "tag"};
+
+    const cJSON *name = cJSON_GetObjectItemCaseSensitive(data, "name");
+    if (! cJSON_IsString(name)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(_self.lock, portMAX_DELAY);
+    cJSON *index = _load_index();
+    if (_sync_index(index)) {
+        _start_hash_task();
+    }
+    cJSON *image = _find_image(index, name->valuestring);
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (image) {
+        for (int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+            const cJSON *value = cJSON_GetObjectItemCaseSensitive(data, keys[i]);
+            if (cJSON_IsString(value)) {
+                _set_string(image, keys[i], value->valuestring);
+            }
+        }
+        err = _save_index(index);
+    }
+    cJSON_Delete(index);
+    xSemaphoreGive(_self.lock);
+    return err;
+}
+
+bool srv_firmware_is_busy(void) {
+    if (_self.lock == NULL) {
+        return false;
+    }
+    xSemaphoreTake(_self.lock, portMAX_DELAY);
+    bool is_busy = (_self.task != NULL || _self.hash_task != NULL);
+    xSemaphoreGive(_self.lock);
+    return is_busy;
+}
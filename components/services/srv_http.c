@@ -7,6 +7,7 @@
 #include "ota_app.h"
 #include "ota_handler.h"
 #include "srv_file.h"
+#include "srv_firmware.h"
 #include "srv_http.h"
 #include "srv_websocket.h"
 
@@ -54,9 +55,21 @@ esp_err_t srv_http_start(const char *base_path, ws_callback_t ws_rx_bin_callback
             .user_ctx  = NULL
         };
         httpd_register_uri_handler(_self.server, &ota_upload);
+
+        /* URI handler for the OTA session state (resume interrupted uploads) */
+        httpd_uri_t ota_status = {
+            .uri       = SRV_HTTP_PATH_OTA,
+            .method    = HTTP_GET,
+            .handler   = ota_get_handler,
+            .user_ctx  = NULL
+        };
+        httpd_register_uri_handler(_self.server, &ota_status);
         
         // Start file service (should be called after above code as it registers uri as well)
         srv_file_start(_self.server, base_path, SRV_HTTP_PATH_WWW);
+
+        // RA4M1 firmware library (WebSocket commands)
+        srv_firmware_init(base_path);
     }
     return err;
 }
@@ -65,6 +78,7 @@ void srv_http_stop() {
     if (_self.server != NULL) {
         // Stop the httpd server
         ESP_LOGI(TAG, "Stopping server");
+        srv_websocket_stop();
         httpd_stop(_self.server);
         _self.server = NULL;
         srv_file_stop();
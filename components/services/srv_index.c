@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs.h"
+
+#include "srv_file.h"
+#include "srv_index.h"
+#include "utils_sha256.h"
+
+#define INDEX_BUCKETS 64
+#define INDEX_PATH_MAX (ESP_VFS_PATH_MAX + SRV_INDEX_NAME_MAX)
+#define IS_FILE_EXT(filename, ext) \
+    (strlen(filename) >= sizeof(ext) - 1 && strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
+
+typedef struct srv_index_node {
+    srv_index_entry_t entry;
+    struct srv_index_node *next;
+} srv_index_node_t;
+
+typedef struct {
+    SemaphoreHandle_t mutex;                  /*!< Protects buckets */
+    srv_index_node_t *buckets[INDEX_BUCKETS]; /*!< Hash table (chained) */
+    size_t count;                             /*!< Number of indexed files */
+    char root_path[ESP_VFS_PATH_MAX + 1];     /*!< Filesystem mount point */
+    size_t root_path_len;
+    char www_path[ESP_VFS_PATH_MAX + 1];      /*!< www directory relative to root */
+    size_t www_path_len;
+} srv_index_data_t;
+
+static const char *TAG = "srv_index";
+
+static srv_index_data_t _self;
+
+const char *srv_index_mime_type(const char *filename) {
+    if (IS_FILE_EXT(filename, ".pdf")) {
+        return "application/pdf";
+    } else if (IS_FILE_EXT(filename, ".html") || IS_FILE_EXT(filename, ".htm")) {
+        return "text/html";
+    } else if (IS_FILE_EXT(filename, ".css")) {
+        return "text/css";
+    } else if (IS_FILE_EXT(filename, ".js")) {
+        return "text/javascript";
+    } else if (IS_FILE_EXT(filename, ".json")) {
+        return "application/json";
+    } else if (IS_FILE_EXT(filename, ".jpeg") || IS_FILE_EXT(filename, ".jpg")) {
+        return "image/jpeg";
+    } else if (IS_FILE_EXT(filename, ".png")) {
+        return "image/png";
+    } else if (IS_FILE_EXT(filename, ".ico")) {
+        return "image/x-icon";
+    }
+    /* This is a limited set only */
+    /* For any other type always set as plain text */
+    return "text/plain";
+}
+
+/* FNV-1a hash of a file name */
+static size_t _hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (uint8_t) *name++) * 16777619u;
+    }
+    return hash % INDEX_BUCKETS;
+}
+
+/* Find a node (index must be locked) */
+static srv_index_node_t *_find(const char *name) {
+    for (srv_index_node_t *node = _self.buckets[_hash(name)]; node != NULL; node = node->next) {
+        if (!strcmp(node->entry.name, name)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void _lock(void) {
+    xSemaphoreTake(_self.mutex, portMAX_DELAY);
+}
+
+static void _unlock(void) {
+    xSemaphoreGive(_self.mutex);
+}
+
+static void _set_etag(srv_index_entry_t *entry, const uint8_t *digest) {
+    char hex[UTILS_SHA256_HEX_SIZE];
+
+    if (digest == NULL) {
+        entry->etag[0] = '\0';
+    } else {
+        utils_sha256_to_hex(digest, hex);
+        snprintf(entry->etag, sizeof(entry->etag), "\"%.16s\"", hex);
+    }
+}
+
+/* Insert or update an entry (index must be locked) */
+static esp_err_t _upsert(const char *name, size_t size, const uint8_t *digest) {
+    if (strlen(name) > SRV_INDEX_NAME_MAX || IS_FILE_EXT(name, SRV_FILE_TMP_SUFFIX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    srv_index_node_t *node = _find(name);
+    if (node == NULL) {
+        node = calloc(1, sizeof(srv_index_node_t));
+        if (node == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        strcpy(node->entry.name, name);
+        node->entry.mime_type = srv_index_mime_type(name);
+        node->entry.is_www = !strncmp(name, _self.www_path, _self.www_path_len) && name[_self.www_path_len] == '/';
+        size_t bucket = _hash(name);
+        node->next = _self.buckets[bucket];
+        _self.buckets[bucket] = node;
+        _self.count++;
+    }
+    node->entry.size = size;
+    _set_etag(&node->entry, digest);
+    return ESP_OK;
+}
+
+/* Recursively add all files in a directory (index must be locked) */
+static void _scan_dir(char *path) {
+    struct dirent *entry;
+    struct stat entry_stat;
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        ESP_LOGE(TAG, "Failed to open %s directory", path);
+        return;
+    }
+
+    size_t path_len = strlen(path);
+    while ((entry = readdir(dir)) != NULL) {
+        strlcat(path, entry->d_name, INDEX_PATH_MAX);
+        if (stat(path, &entry_stat) == -1) {
+            ESP_LOGE(TAG, "Failed to stat : %s", entry->d_name);
+        } else if (S_ISDIR(entry_stat.st_mode)) {
+            strlcat(path, "/", INDEX_PATH_MAX);
+            _scan_dir(path);
+        } else {
+            _upsert(path + _self.root_path_len, entry_stat.st_size, NULL);
+        }
+        path[path_len] = 0; // Reset to parent path
+    }
+    closedir(dir);
+}
+
+/* Get name relative to root from an absolute path */
+static const char *_relative_name(const char *path) {
+    if (strncmp(path, _self.root_path, _self.root_path_len) || path[_self.root_path_len] != '/') {
+        return NULL;
+    }
+    return path + _self.root_path_len;
+}
+
+static void _clear(void) {
+    for (int i = 0; i < INDEX_BUCKETS; i++) {
+        srv_index_node_t *node = _self.buckets[i];
+        while (node != NULL) {
+            srv_index_node_t *next = node->next;
+            free(node);
+            node = next;
+        }
+        _self.buckets[i] = NULL;
+    }
+    _self.count = 0;
+}
+
+esp_err_t srv_index_init(void) {
+    if (_self.mutex == NULL) {
+        _self.mutex = xSemaphoreCreateMutex();
+        if (_self.mutex == NULL) {
+            ESP_LOGE(TAG, "Unable to create index mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t srv_index_build(const char *root_path, const char *www_path) {
+    char path[INDEX_PATH_MAX + 1];
+
+    _lock();
+    _clear();
+    strlcpy(_self.root_path, root_path, sizeof(_self.root_path));
+    _self.root_path_len = strlen(_self.root_path);
+    strlcpy(_self.www_path, www_path, sizeof(_self.www_path));
+    _self.www_path_len = strlen(_self.www_path);
+
+    int64_t start = esp_timer_get_time();
+    snprintf(path, sizeof(path), "%s/", _self.root_path);
+    _scan_dir(path);
+    ESP_LOGI(TAG, "Indexed %u files in %lld ms", _self.count, (esp_timer_get_time() - start) / 1000);
+    _unlock();
+    return ESP_OK;
+}
+
+void srv_index_clear(void) {
+    _lock();
+    _clear();
+    _unlock();
+}
+
+bool srv_index_lookup(const char *name, srv_index_entry_t *entry) {
+    _lock();
+    srv_index_node_t *node = _find(name);
+    if (node != NULL) {
+        *entry = node->entry;
+    }
+    _unlock();
+    return node != NULL;
+}
+
+esp_err_t srv_index_update(const char *path, const uint8_t *digest) {
+    struct stat st;
+
+    const char *name = _relative_name(path);
+    if (name == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stat(path, &st) != 0 || S_ISDIR(st.st_mode)) {
+        srv_index_remove(path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    _lock();
+    esp_err_t err = _upsert(name, st.st_size, digest);
+    _unlock();
+    return err;
+}
+
+void srv_index_set_digest(const char *name, const uint8_t *digest) {
+    _lock();
+    srv_index_node_t *node = _find(name);
+    if (node != NULL) {
+        _set_etag(&node->entry, digest);
+    }
+    _unlock();
+}
+
+void srv_index_remove(const char *path) {
+    const char *name = _relative_name(path);
+    if (name == NULL) {
+        return;
+    }
+    _lock();
+    srv_index_node_t **link = &_self.buckets[_hash(name)];
+    while (*link != NULL) {
+        if (!strcmp((*link)->entry.name, name)) {
+            srv_index_node_t *node = *link;
+            *link = node->next;
+            free(node);
+            _self.count--;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    _unlock();
+}
+
+void srv_index_foreach(srv_index_cb_t cb, void *ctx) {
+    _lock();
+    for (int i = 0; i < INDEX_BUCKETS; i++) {
+        for (srv_index_node_t *node = _self.buckets[i]; node != NULL; node = node->next) {
+            cb(&node->entry, ctx);
+        }
+    }
+    _unlock();
+}
@@ -3,17 +3,69 @@
 #include "esp_log.h"
 #include "esp_littlefs.h"
 #include "esp_vfs.h"
+#include "nvs.h"
 
+#include "ra4m1_flash.h"
+#include "srv_firmware.h"
+#include "srv_http.h"
+#include "srv_index.h"
 #include "srv_littlefs.h"
 
+#define NVS_LITTLEFS_NAMESPACE "littlefs"
+#define NVS_LITTLEFS_SLOT       "slot"
+
 typedef struct {
     char base_path[ESP_VFS_PATH_MAX+1];  
+    uint8_t slot;                        /*!< Active (mounted) slot */
+    uint8_t slot_count;                  /*!< 2 with A/B partitions, 1 otherwise */
+    srv_littlefs_switch_cb_t switch_cb;  /*!< Carries files over to the updated slot */
 } srv_littlefs_data_t;
 
 static const char *TAG = "srv_littlefs";
 
+static const char *_labels[] = { SRV_LITTLEFS_LABEL_A, SRV_LITTLEFS_LABEL_B };
+
 static srv_littlefs_data_t _self;
 
+/* Load the active slot (A unless another one was selected) */
+static void _srv_littlefs_load_slot(void) {
+    nvs_handle_t nvs;
+    _self.slot = 0;
+    _self.slot_count = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_LITTLEFS, SRV_LITTLEFS_LABEL_B) ? 2 : 1;
+    if (_self.slot_count > 1 && nvs_open(NVS_LITTLEFS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        if (nvs_get_u8(nvs, NVS_LITTLEFS_SLOT, &_self.slot) != ESP_OK || _self.slot >= _self.slot_count) {
+            _self.slot = 0;
+        }
+        nvs_close(nvs);
+    }
+}
+
+static esp_err_t _srv_littlefs_save_slot(uint8_t slot) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_LITTLEFS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_u8(nvs, NVS_LITTLEFS_SLOT, slot);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to save active LITTLEFS slot (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t _srv_littlefs_mount(void) {
+    ESP_LOGI(TAG, "Mounting LITTLEFS partition '%s'", _labels[_self.slot]);
+    esp_vfs_littlefs_conf_t conf = {
+      .base_path = _self.base_path,
+      .partition_label = _labels[_self.slot],
+      .format_if_mount_failed = false
+    };
+    return esp_vfs_littlefs_register(&conf);
+}
+
 esp_err_t srv_littlefs_start(char* base_path) {
     ESP_LOGI(TAG, "Initializing LITTLEFS");
     ESP_ERROR_CHECK(base_path != NULL ? ESP_OK : ESP_FAIL);
@@ -21,12 +73,17 @@ esp_err_t srv_littlefs_start(char* base_path) {
     strncpy(_self.base_path, base_path, ESP_VFS_PATH_MAX);
     _self.base_path[ESP_VFS_PATH_MAX] = '\0';
 
-    esp_vfs_littlefs_conf_t conf = {
-      .base_path = _self.base_path,
-      .partition_label = NULL,
-      .format_if_mount_failed = false
-    };
-    esp_err_t ret = esp_vfs_littlefs_register(&conf);
+    // Index lock, created before any task can use the index
+    ESP_ERROR_CHECK(srv_index_init());
+
+    _srv_littlefs_load_slot();
+    esp_err_t ret = _srv_littlefs_mount();
+    if (ret == ESP_FAIL && _self.slot_count > 1) {
+        /* Active slot not mountable (e.g. interrupted switch), fall back to the other one */
+        ESP_LOGW(TAG, "Unable to mount '%s', trying '%s'", _labels[_self.slot], _labels[1 - _self.slot]);
+        _self.slot = 1 - _self.slot;
+        ret = _srv_littlefs_mount();
+    }
 
     if (ret != ESP_OK) {
         if (ret == ESP_FAIL) {
@@ -40,12 +97,15 @@ esp_err_t srv_littlefs_start(char* base_path) {
     }
 
     size_t total = 0, used = 0;
-    ret = esp_littlefs_info(NULL, &total, &used);
+    ret = esp_littlefs_info(_labels[_self.slot], &total, &used);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to get LITTLEFS partition information (%s)", esp_err_to_name(ret));
     } else {
         ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
     }
+
+    // Build file metadata index once (kept up to date by file services)
+    srv_index_build(_self.base_path, SRV_HTTP_PATH_WWW);
     return ret;
 }
 
@@ -54,5 +114,74 @@ esp_err_t srv_littlefs_restart() {
 }
 
 esp_err_t srv_littlefs_stop(void) {
-    return esp_vfs_littlefs_unregister(NULL);
+    srv_index_clear();
+    return esp_vfs_littlefs_unregister(_labels[_self.slot]);
+}
+
+const esp_partition_t *srv_littlefs_get_update_partition(void) {
+    uint8_t slot = (_self.slot_count > 1) ? 1 - _self.slot : _self.slot;
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_LITTLEFS, _labels[slot]);
+}
+
+bool srv_littlefs_is_mounted(const esp_partition_t *partition) {
+    return partition && !strcmp(partition->label, _labels[_self.slot]);
+}
+
+void srv_littlefs_set_switch_callback(srv_littlefs_switch_cb_t callback) {
+    _self.switch_cb = callback;
+}
+
+/* Let the callback copy files to the updated slot (mounted aside) */
+static void _srv_littlefs_carry_over(uint8_t slot) {
+    if (_self.switch_cb == NULL) {
+        return;
+    }
+    esp_vfs_littlefs_conf_t conf = {
+      .base_path = SRV_LITTLEFS_NEXT_PATH,
+      .partition_label = _labels[slot],
+      .format_if_mount_failed = false
+    };
+    esp_err_t err = esp_vfs_littlefs_register(&conf);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to mount '%s' to carry files over (%s)", _labels[slot], esp_err_to_name(err));
+        return;
+    }
+    _self.switch_cb(SRV_LITTLEFS_NEXT_PATH);
+    esp_vfs_littlefs_unregister(_labels[slot]);
+}
+
+esp_err_t srv_littlefs_switch(void) {
+    if (_self.slot_count < 2) {
+        return srv_littlefs_restart();
+    }
+    /* Files of the mounted slot may be open (RA4M1 image, firmware library) */
+    if (ra4m1_flash_is_busy() || srv_firmware_is_busy()) {
+        ESP_LOGW(TAG, "Files in use, not switching LITTLEFS partition");
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t old_slot = _self.slot;
+    _srv_littlefs_carry_over(1 - old_slot);
+    srv_littlefs_stop();
+    _self.slot = 1 - old_slot;
+    esp_err_t err = _srv_littlefs_mount();
+    if (err == ESP_OK) {
+        err = _srv_littlefs_save_slot(_self.slot);
+    }
+    if (err != ESP_OK) {
+        /* Keep serving the previous file system */
+        ESP_LOGE(TAG, "Unable to switch to LITTLEFS partition '%s' (%s)", _labels[_self.slot], esp_err_to_name(err));
+        if (esp_littlefs_mounted(_labels[_self.slot])) {
+            esp_vfs_littlefs_unregister(_labels[_self.slot]);
+        }
+        _self.slot = old_slot;
+        esp_err_t revert_err = _srv_littlefs_mount();
+        if (revert_err != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to remount LITTLEFS partition '%s' (%s), no file system mounted",
+                     _labels[_self.slot], esp_err_to_name(revert_err));
+        }
+    } else {
+        ESP_LOGI(TAG, "Switched to LITTLEFS partition '%s'", _labels[_self.slot]);
+    }
+    srv_index_build(_self.base_path, SRV_HTTP_PATH_WWW);
+    return err;
 }
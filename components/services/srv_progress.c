@@ -0,0 +1,135 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "srv_progress.h"
+#include "srv_websocket.h"
+
+#define PROGRESS_INTERVAL_US (500 * 1000)  /*!< Minimum interval between two updates of the same stage */
+#define PROGRESS_TARGET_SIZE 24
+
+typedef struct {
+    SemaphoreHandle_t mutex;           /*!< Protects the state below */
+    bool is_active;                    /*!< Operation started (last state kept once done) */
+    char target[PROGRESS_TARGET_SIZE];
+    const char *stage;
+    size_t total;
+    size_t received;
+    size_t written;
+    esp_err_t result;
+    int64_t start_time;                /*!< Operation start (us) */
+    int64_t elapsed;                   /*!< Elapsed time at last update (us) */
+    int64_t last_sent;                 /*!< Time of the last broadcast (us) */
+} srv_progress_data_t;
+
+static const char *TAG = "srv_progress";
+
+static srv_progress_data_t _self;
+
+esp_err_t srv_progress_init(void) {
+    if (_self.mutex == NULL) {
+        _self.mutex = xSemaphoreCreateMutex();
+        if (_self.mutex == NULL) {
+            ESP_LOGE(TAG, "Unable to create progress mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+static bool _lock(void) {
+    return _self.mutex && xSemaphoreTake(_self.mutex, portMAX_DELAY) == pdTRUE;
+}
+
+/* Build the progress message data (mutex must be held) */
+static cJSON *_json_progress(void) {
+    cJSON *data = cJSON_CreateObject();
+    cJSON_AddStringToObject(data, "target", _self.target);
+    cJSON_AddStringToObject(data, "stage", _self.stage);
+    cJSON_AddNumberToObject(data, "total", _self.total);
+    cJSON_AddNumberToObject(data, "received", _self.received);
+    cJSON_AddNumberToObject(data, "written", _self.written);
+
+    /* Throughput (bytes/s) and ETA (s) based on written bytes */
+    int64_t throughput = (_self.elapsed > 0) ? ((int64_t) _self.written * 1000000) / _self.elapsed : 0;
+    cJSON_AddNumberToObject(data, "throughput", throughput);
+    if (throughput > 0 && _self.total >= _self.written && strcmp(_self.stage, SRV_PROGRESS_STAGE_DONE)) {
+        cJSON_AddNumberToObject(data, "eta", (double) (_self.total - _self.written) / throughput);
+    }
+    cJSON_AddNumberToObject(data, "elapsed", (double) _self.elapsed / 1000000);
+    if (!strcmp(_self.stage, SRV_PROGRESS_STAGE_DONE)) {
+        cJSON_AddNumberToObject(data, "result", _self.result);
+    }
+    return data;
+}
+
+/* Broadcast the current state (mutex must be held) */
+static void _send(int sockfd) {
+    cJSON *data = _json_progress();
+    srv_websocket_send_json_msg(sockfd, JSON_MSG_IND_PROGRESS, data);
+    cJSON_Delete(data);
+}
+
+void srv_progress_begin(const char *target, size_t total) {
+    if (!_lock()) {
+        return;
+    }
+    _self.is_active = true;
+    strlcpy(_self.target, target, sizeof(_self.target));
+    _self.stage = SRV_PROGRESS_STAGE_RECEIVE;
+    _self.total = total;
+    _self.received = 0;
+    _self.written = 0;
+    _self.result = ESP_OK;
+    _self.start_time = esp_timer_get_time();
+    _self.elapsed = 0;
+    _self.last_sent = _self.start_time;
+    _send(-1);
+    xSemaphoreGive(_self.mutex);
+}
+
+void srv_progress_update(const char *stage, size_t received, size_t written) {
+    if (!_lock()) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    bool stage_changed = (_self.stage != stage);
+    _self.stage = stage;
+    _self.received = received;
+    _self.written = written;
+    _self.elapsed = now - _self.start_time;
+    if (_self.is_active && (stage_changed || (now - _self.last_sent) >= PROGRESS_INTERVAL_US)) {
+        _self.last_sent = now;
+        _send(-1);
+    }
+    xSemaphoreGive(_self.mutex);
+}
+
+void srv_progress_end(esp_err_t result) {
+    if (!_lock()) {
+        return;
+    }
+    _self.stage = SRV_PROGRESS_STAGE_DONE;
+    _self.result = result;
+    _self.elapsed = esp_timer_get_time() - _self.start_time;
+    ESP_LOGI(TAG, "%s: %s (%u bytes in %lld ms)", _self.target, (result == ESP_OK) ? "done" : esp_err_to_name(result),
+             _self.written, _self.elapsed / 1000);
+    if (_self.is_active) {
+        _send(-1);
+    }
+    xSemaphoreGive(_self.mutex);
+}
+
+void srv_progress_send_last(int sockfd) {
+    if (!_lock()) {
+        return;
+    }
+    if (_self.is_active) {
+        _send(sockfd);
+    }
+    xSemaphoreGive(_self.mutex);
+}
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+#include "esp_log.h"
+#include "esp_vfs.h"
+#include "esp_littlefs.h"
+
+#include "srv_file.h"
+#include "srv_index.h"
+#include "srv_tar.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_PATH_MAX   (ESP_VFS_PATH_MAX + CONFIG_LITTLEFS_OBJ_NAME_LEN)
+
+// ustar header layout
+#define TAR_NAME_OFFSET     0
+#define TAR_NAME_LEN        100
+#define TAR_SIZE_OFFSET     124
+#define TAR_SIZE_LEN        12
+#define TAR_CHKSUM_OFFSET   148
+#define TAR_CHKSUM_LEN      8
+#define TAR_TYPE_OFFSET     156
+#define TAR_MAGIC_OFFSET    257
+#define TAR_PREFIX_OFFSET   345
+#define TAR_PREFIX_LEN      155
+
+#define TAR_TYPE_FILE       '0'
+#define TAR_TYPE_FILE_OLD   '\0'
+#define TAR_TYPE_DIR        '5'
+
+typedef enum {
+    TAR_STATE_HEADER,  /*!< Accumulating a header block */
+    TAR_STATE_DATA,    /*!< Receiving member data */
+    TAR_STATE_PADDING, /*!< Skipping padding up to the next block */
+    TAR_STATE_END,     /*!< End of archive marker received */
+} tar_state_t;
+
+struct srv_tar {
+    tar_state_t state;
+    uint8_t block[TAR_BLOCK_SIZE];  /*!< Header block being received */
+    size_t block_len;               /*!< Bytes accumulated in block */
+    size_t data_left;               /*!< Member data bytes left to receive */
+    size_t padding_left;            /*!< Padding bytes left to skip */
+    int zero_blocks;                /*!< Consecutive zero blocks (2 = end of archive) */
+    FILE *fd;                       /*!< Current member (NULL if skipped) */
+    esp_err_t member_err;           /*!< Current member result */
+    cJSON *member;                  /*!< Current member result entry */
+    char path[TAR_PATH_MAX];        /*!< Current member path */
+    char tmppath[TAR_PATH_MAX];     /*!< Current member temporary path */
+    char dest_path[ESP_VFS_PATH_MAX + 1];
+    cJSON *results;
+};
+
+static const char *TAG = "srv_tar";
+
+srv_tar_t *srv_tar_create(const char *dest_path, cJSON *results) {
+    srv_tar_t *tar = calloc(1, sizeof(srv_tar_t));
+    if (tar != NULL) {
+        strlcpy(tar->dest_path, dest_path, sizeof(tar->dest_path));
+        tar->results = results;
+        tar->state = TAR_STATE_HEADER;
+    }
+    return tar;
+}
+
+/* Parse an octal numeric field */
+static bool _parse_octal(const uint8_t *field, size_t len, size_t *value) {
+    size_t i = 0;
+    *value = 0;
+    while (i < len && field[i] == ' ') i++;
+    if (i == len || field[i] < '0' || field[i] > '7') {
+        return false;
+    }
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        *value = (*value << 3) | (field[i] - '0');
+    }
+    return true;
+}
+
+static bool _is_zero_block(const uint8_t *block) {
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        if (block[i]) return false;
+    }
+    return true;
+}
+
+static bool _checksum_is_valid(const uint8_t *block) {
+    size_t expected;
+    if (!_parse_octal(block + TAR_CHKSUM_OFFSET, TAR_CHKSUM_LEN, &expected)) {
+        return false;
+    }
+    // Checksum is computed with the checksum field set to spaces
+    size_t sum = ' ' * TAR_CHKSUM_LEN;
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        if (i < TAR_CHKSUM_OFFSET || i >= TAR_CHKSUM_OFFSET + TAR_CHKSUM_LEN) {
+            sum += block[i];
+        }
+    }
+    return sum == expected;
+}
+
+/* Build destination path from (prefix/)name, rejecting paths escaping dest_path */
+static esp_err_t _member_path(srv_tar_t *tar, char *name, size_t name_size) {
+    char prefix[TAR_PREFIX_LEN + 1];
+    char member[TAR_NAME_LEN + 1];
+
+    memcpy(member, tar->block + TAR_NAME_OFFSET, TAR_NAME_LEN);
+    member[TAR_NAME_LEN] = '\0';
+    prefix[0] = '\0';
+    if (!memcmp(tar->block + TAR_MAGIC_OFFSET, "ustar", 5)) {
+        memcpy(prefix, tar->block + TAR_PREFIX_OFFSET, TAR_PREFIX_LEN);
+        prefix[TAR_PREFIX_LEN] = '\0';
+    }
+    snprintf(name, name_size, "%s%s%s", prefix, prefix[0] ? "/" : "", member);
+
+    // Strip leading "./" and "/"
+    char *start = name;
+    while (start[0] == '/' || (start[0] == '.' && start[1] == '/')) {
+        start += (start[0] == '/') ? 1 : 2;
+    }
+    memmove(name, start, strlen(start) + 1);
+
+    // Remove trailing '/' (directories)
+    size_t len = strlen(name);
+    while (len > 0 && name[len - 1] == '/') {
+        name[--len] = '\0';
+    }
+
+    if (len == 0 || strstr(name, "..") != NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (snprintf(tar->path, sizeof(tar->path), "%s/%s", tar->dest_path, name) >= sizeof(tar->path) ||
+        snprintf(tar->tmppath, sizeof(tar->tmppath), "%s" SRV_FILE_TMP_SUFFIX, tar->path) >= sizeof(tar->tmppath)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+/* Create all parent directories of path */
+static void _make_parent_dirs(const char *path, size_t root_len) {
+    char dir[TAR_PATH_MAX];
+    struct stat st;
+
+    strlcpy(dir, path, sizeof(dir));
+    for (char *p = dir + root_len + 1; (p = strchr(p, '/')) != NULL; p++) {
+        *p = '\0';
+        if (stat(dir, &st) != 0) {
+            mkdir(dir, 0775);
+        }
+        *p = '/';
+    }
+}
+
+/* Close current member, renaming it over the target if complete */
+static void _member_close(srv_tar_t *tar) {
+    if (tar->fd != NULL) {
+        if (fclose(tar->fd) != 0 && tar->member_err == ESP_OK) {
+            tar->member_err = ESP_FAIL;
+        }
+        tar->fd = NULL;
+        if (tar->member_err == ESP_OK && tar->data_left == 0) {
+            if (rename(tar->tmppath, tar->path) != 0) {
+                tar->member_err = ESP_FAIL;
+            } else {
+                srv_index_update(tar->path, NULL);
+            }
+        } else if (tar->member_err == ESP_OK) {
+            tar->member_err = ESP_ERR_INVALID_SIZE;
+        }
+        if (tar->member_err != ESP_OK) {
+            unlink(tar->tmppath);
+        }
+    }
+    if (tar->member != NULL) {
+        cJSON_AddNumberToObject(tar->member, "result", tar->member_err);
+        if (tar->member_err == ESP_OK) {
+            ESP_LOGI(TAG, "Extracted %s", tar->path);
+        } else {
+            ESP_LOGW(TAG, "Failed to extract %s (%s)", tar->path, esp_err_to_name(tar->member_err));
+        }
+        tar->member = NULL;
+    }
+}
+
+/* Process a complete header block */
+static esp_err_t _process_header(srv_tar_t *tar) {
+    char name[TAR_PREFIX_LEN + TAR_NAME_LEN + 2];
+    size_t size;
+
+    if (_is_zero_block(tar->block)) {
+        if (++tar->zero_blocks == 2) {
+            tar->state = TAR_STATE_END;
+        }
+        return ESP_OK;
+    }
+    tar->zero_blocks = 0;
+
+    if (!_checksum_is_valid(tar->block) || !_parse_octal(tar->block + TAR_SIZE_OFFSET, TAR_SIZE_LEN, &size)) {
+        ESP_LOGE(TAG, "Invalid tar header");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    char type = tar->block[TAR_TYPE_OFFSET];
+    tar->data_left = size;
+    tar->padding_left = (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+    tar->state = (size > 0) ? TAR_STATE_DATA : TAR_STATE_HEADER;
+
+    if (type != TAR_TYPE_FILE && type != TAR_TYPE_FILE_OLD && type != TAR_TYPE_DIR) {
+        // Links, pax/GNU extended headers, ... are skipped
+        ESP_LOGW(TAG, "Skipping tar entry (type '%c')", type);
+        return ESP_OK;
+    }
+
+    esp_err_t err = _member_path(tar, name, sizeof(name));
+    if (err == ESP_ERR_INVALID_ARG && type == TAR_TYPE_DIR) {
+        // Archive root ("./")
+        return ESP_OK;
+    }
+
+    if (type == TAR_TYPE_DIR) {
+        if (err == ESP_OK) {
+            struct stat st;
+            _make_parent_dirs(tar->path, strlen(tar->dest_path));
+            if (stat(tar->path, &st) != 0) {
+                mkdir(tar->path, 0775);
+            }
+        }
+        return ESP_OK;
+    }
+
+    tar->member = cJSON_CreateObject();
+    cJSON_AddItemToArray(tar->results, tar->member);
+    cJSON_AddStringToObject(tar->member, "name", name);
+    cJSON_AddNumberToObject(tar->member, "size", size);
+    tar->member_err = err;
+
+    if (err == ESP_OK) {
+        _make_parent_dirs(tar->path, strlen(tar->dest_path));
+        tar->fd = fopen(tar->tmppath, "w");
+        if (tar->fd == NULL) {
+            ESP_LOGE(TAG, "Failed to create file : %s", tar->tmppath);
+            tar->member_err = ESP_FAIL;
+        }
+    }
+    if (size == 0) {
+        _member_close(tar);
+    }
+    return ESP_OK;
+}
+
+esp_err_t srv_tar_write(srv_tar_t *tar, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        size_t n;
+        switch (tar->state) {
+            case TAR_STATE_HEADER:
+                n = MIN(TAR_BLOCK_SIZE - tar->block_len, len);
+                memcpy(tar->block + tar->block_len, data, n);
+                tar->block_len += n;
+                if (tar->block_len == TAR_BLOCK_SIZE) {
+                    tar->block_len = 0;
+                    esp_err_t err = _process_header(tar);
+                    if (err != ESP_OK) {
+                        return err;
+                    }
+                }
+                break;
+            case TAR_STATE_DATA:
+                n = MIN(tar->data_left, len);
+                if (tar->fd != NULL && fwrite(data, 1, n, tar->fd) != n) {
+                    ESP_LOGE(TAG, "File write failed : %s", tar->tmppath);
+                    tar->member_err = ESP_FAIL;
+                    fclose(tar->fd);
+                    tar->fd = NULL;
+                    unlink(tar->tmppath);
+                }
+                tar->data_left -= n;
+                if (tar->data_left == 0) {
+                    _member_close(tar);
+                    tar->state = (tar->padding_left > 0) ? TAR_STATE_PADDING : TAR_STATE_HEADER;
+                }
+                break;
+            case TAR_STATE_PADDING:
+                n = MIN(tar->padding_left, len);
+                tar->padding_left -= n;
+                if (tar->padding_left == 0) {
+                    tar->state = TAR_STATE_HEADER;
+                }
+                break;
+            case TAR_STATE_END:
+            default:
+                // Ignore anything after the end of archive marker (record padding)
+                return ESP_OK;
+        }
+        data += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t srv_tar_finish(srv_tar_t *tar) {
+    // Some archivers omit the end of archive marker, accept a block boundary
+    if (tar->state == TAR_STATE_END || (tar->state == TAR_STATE_HEADER && tar->block_len == 0)) {
+        return ESP_OK;
+    }
+    ESP_LOGE(TAG, "Truncated tar archive");
+    return ESP_ERR_INVALID_SIZE;
+}
+
+void srv_tar_destroy(srv_tar_t *tar) {
+    if (tar != NULL) {
+        _member_close(tar);
+        free(tar);
+    }
+}
@@ -1,3 +1,5 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_idf_version.h"
 #include "esp_app_desc.h"
@@ -5,6 +7,8 @@
 #include "app_config.h"
 #include "ra4m1_ctrl.h"
 #include "srv_file.h"
+#include "srv_firmware.h"
+#include "srv_progress.h"
 #include "srv_websocket.h"
 
 typedef struct {
@@ -16,6 +20,7 @@ typedef struct {
 typedef struct {
     ws_callback_t ws_rx_bin_callback;
     httpd_handle_t server;    
+    TaskHandle_t server_task;    /*!< HTTP server task, work queued from it would wait for the current handler */
 } srv_websocket_data_t;
 
 static const char *TAG = "srv_websocket";
@@ -34,6 +39,13 @@ static void _json_add_system_info(cJSON *data) {
     cJSON_AddStringToObject(esp32_firmware, "version", app_description->version);
     cJSON_AddStringToObject(esp32_firmware, "compile_time", app_description->time);
     cJSON_AddStringToObject(esp32_firmware, "compile_date", app_description->date);
+
+    char asset_version[32];
+    if (srv_file_get_asset_version(asset_version, sizeof(asset_version)) == ESP_OK) {
+        cJSON *www = cJSON_CreateObject();
+        cJSON_AddItemToObject(data, "www", www);
+        cJSON_AddStringToObject(www, "version", asset_version);
+    }
 }
 
 /* Add network parameters to json object */
@@ -147,6 +159,12 @@ static esp_err_t _srv_websocket_send(
         return alloc_ret;
     }
 
+    // Send right away when called from a (long running) handler of the server task
+    if (_self.server_task == xTaskGetCurrentTaskHandle()) {
+        _srv_websocket_send_callback(rep_arg);
+        return ESP_OK;
+    }
+
     esp_err_t ret = httpd_queue_work(hServer, _srv_websocket_send_callback, (void *) rep_arg);
     if (ret != ESP_OK) {
         ESP_LOGW(TAG, "WS Unable to send message");
@@ -223,10 +241,30 @@ esp_err_t srv_websocket_send_bin(uint8_t *buffer, uint32_t buffer_length) {
         _self.server, -1, HTTPD_WS_TYPE_BINARY, _ws_payload_alloc_bin, buffer, buffer_length);
 }
 
+/* Send json message with data using websocket.
+    Function can be called from a different thread) */
+esp_err_t srv_websocket_send_json_msg(int hSocket, int msgId, cJSON *data) {
+    if (_self.server == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddNumberToObject(msg, JSON_MSG, msgId);
+    if (data) {
+        cJSON_AddItemReferenceToObject(msg, JSON_DATA, data);
+    }
+    esp_err_t ret = _srv_websocket_send(
+        _self.server, hSocket, HTTPD_WS_TYPE_TEXT, _ws_payload_alloc_json, msg, 0);
+    cJSON_Delete(msg);
+    return ret;
+}
+
 /* Handler processing incoming requests  */
 esp_err_t srv_websocket_get_handler(httpd_req_t *req) {
+    _self.server_task = xTaskGetCurrentTaskHandle();
     if (req->method == HTTP_GET) {
         ESP_LOGI(TAG, "Handshake done, a new connection is opened");
+        // Let the new client know about any operation in progress
+        srv_progress_send_last(httpd_req_to_sockfd(req));
         return ESP_OK;
     }
     httpd_ws_frame_t ws_pkt;
@@ -287,6 +325,17 @@ esp_err_t srv_websocket_get_handler(httpd_req_t *req) {
                                 result = srv_file_json_delete_files(cJSON_GetObjectItem(json,"list_files"));
                                 _srv_websocket_send_json_result(req, JSON_MSG_REP_DELETE_FILES, result, false);
                                 break;
+                            case JSON_MSG_REQ_LIST_FIRMWARE:
+                                _srv_websocket_send_json(req, JSON_MSG_REP_LIST_FIRMWARE, srv_firmware_json_list, false);
+                                break;
+                            case JSON_MSG_REQ_SELECT_FIRMWARE:
+                                result = srv_firmware_json_select(cJSON_GetObjectItemCaseSensitive(json, "data"));
+                                _srv_websocket_send_json_result(req, JSON_MSG_REP_SELECT_FIRMWARE, result, false);
+                                break;
+                            case JSON_MSG_REQ_TAG_FIRMWARE:
+                                result = srv_firmware_json_tag(cJSON_GetObjectItemCaseSensitive(json, "data"));
+                                _srv_websocket_send_json_result(req, JSON_MSG_REP_TAG_FIRMWARE, result, false);
+                                break;
                             default:
                                 ESP_LOGW(TAG, "Unknown message id (%d)", json_id->valueint);
                                 break;
@@ -322,4 +371,10 @@ esp_err_t srv_websocket_init(httpd_handle_t server, ws_callback_t ws_rx_bin_call
     _self.server = server;
     _self.ws_rx_bin_callback = ws_rx_bin_callback;
     return ESP_OK;
+}
+
+/* Stop websocket service */
+void srv_websocket_stop() {
+    _self.server = NULL;
+    _self.server_task = NULL;
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef _UTILS_GZIP_H_
+#define _UTILS_GZIP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Callback receiving decompressed data.
+ *
+ * @param ctx  User context provided to utils_gzip_create().
+ * @param data Pointer to decompressed data.
+ * @param len  Length of decompressed data in bytes.
+ * @return ESP_OK to continue, any other value aborts decompression.
+ */
+typedef esp_err_t (*utils_gzip_output_t)(void *ctx, const uint8_t *data, size_t len);
+
+/**
+ * @brief Opaque streaming gzip decompressor.
+ */
+typedef struct utils_gzip utils_gzip_t;
+
+/**
+ * @brief Check whether a buffer starts with the gzip magic bytes.
+ *
+ * @param data Pointer to the first bytes of a stream.
+ * @param len  Number of bytes available.
+ * @return true if data looks like a gzip stream.
+ */
+bool utils_gzip_is_gzip(const uint8_t *data, size_t len);
+
+/**
+ * @brief Create a streaming gzip decompressor.
+ *
+ * Decompressed data is delivered through the output callback using a fixed
+ * 32KB sliding window (deflate dictionary size), whatever the stream size.
+ *
+ * @param output Callback receiving decompressed data.
+ * @param ctx    User context passed to the callback.
+ * @return Decompressor handle or NULL if out of memory.
+ */
+utils_gzip_t *utils_gzip_create(utils_gzip_output_t output, void *ctx);
+
+/**
+ * @brief Feed compressed data to the decompressor.
+ *
+ * @param gzip Decompressor handle.
+ * @param data Pointer to compressed data.
+ * @param len  Length of compressed data in bytes.
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE on corrupted data or
+ *         the error returned by the output callback.
+ */
+esp_err_t utils_gzip_write(utils_gzip_t *gzip, const uint8_t *data, size_t len);
+
+/**
+ * @brief Check that the complete stream has been received and is valid (CRC/size).
+ *
+ * @param gzip Decompressor handle.
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if truncated,
+ *         ESP_ERR_INVALID_CRC on checksum mismatch.
+ */
+esp_err_t utils_gzip_finish(utils_gzip_t *gzip);
+
+/**
+ * @brief Total number of decompressed bytes delivered so far.
+ *
+ * @param gzip Decompressor handle.
+ * @return Number of bytes.
+ */
+size_t utils_gzip_output_size(const utils_gzip_t *gzip);
+
+/**
+ * @brief Error found in the compressed stream itself.
+ *
+ * Errors returned by the output callback are not reported, so that invalid
+ * compressed data can be told apart from failures of the consumer.
+ *
+ * @param gzip Decompressor handle (can be NULL).
+ * @return ESP_OK if the stream is valid so far, otherwise the first error
+ *         returned by utils_gzip_write() or utils_gzip_finish() for it.
+ */
+esp_err_t utils_gzip_get_error(const utils_gzip_t *gzip);
+
+/**
+ * @brief Release decompressor resources.
+ *
+ * @param gzip Decompressor handle (can be NULL).
+ */
+void utils_gzip_destroy(utils_gzip_t *gzip);
+
+#endif
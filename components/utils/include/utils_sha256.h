@@ -0,0 +1,39 @@
+#ifndef _UTILS_SHA256_H_
+#define _UTILS_SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define UTILS_SHA256_SIZE     32
+#define UTILS_SHA256_HEX_SIZE (2 * UTILS_SHA256_SIZE + 1)
+
+/**
+ * @brief Convert a SHA-256 digest to a lowercase hexadecimal string.
+ *
+ * @param digest Digest to convert (UTILS_SHA256_SIZE bytes).
+ * @param hex    Destination buffer (UTILS_SHA256_HEX_SIZE bytes, NULL terminated).
+ */
+void utils_sha256_to_hex(const uint8_t *digest, char *hex);
+
+/**
+ * @brief Parse a hexadecimal string (case insensitive) into a SHA-256 digest.
+ *
+ * @param hex    Hexadecimal string (64 characters).
+ * @param digest Destination buffer (UTILS_SHA256_SIZE bytes).
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if hex is not a valid digest.
+ */
+esp_err_t utils_sha256_from_hex(const char *hex, uint8_t *digest);
+
+/**
+ * @brief Compute the SHA-256 digest of a file.
+ *
+ * @param filename Path to the file.
+ * @param digest   Destination buffer (UTILS_SHA256_SIZE bytes).
+ * @param size     Optional pointer to store the file size (can be NULL).
+ * @return ESP_OK on success, ESP_FAIL if the file can't be read.
+ */
+esp_err_t utils_sha256_file(const char *filename, uint8_t *digest, size_t *size);
+
+#endif
@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "rom/miniz.h"
+
+#include "utils_gzip.h"
+
+// gzip header (RFC 1952)
+#define GZIP_MAGIC_0    0x1f
+#define GZIP_MAGIC_1    0x8b
+#define GZIP_CM_DEFLATE 8
+#define GZIP_HEADER_LEN 10
+#define GZIP_TRAILER_LEN 8
+
+#define GZIP_FLAG_FHCRC    0x02
+#define GZIP_FLAG_FEXTRA   0x04
+#define GZIP_FLAG_FNAME    0x08
+#define GZIP_FLAG_FCOMMENT 0x10
+
+typedef enum {
+    GZIP_STATE_HEADER,
+    GZIP_STATE_EXTRA_LEN,
+    GZIP_STATE_EXTRA,
+    GZIP_STATE_NAME,
+    GZIP_STATE_COMMENT,
+    GZIP_STATE_HCRC,
+    GZIP_STATE_DATA,
+    GZIP_STATE_TRAILER,
+    GZIP_STATE_DONE,
+} gzip_state_t;
+
+struct utils_gzip {
+    gzip_state_t state;            /*!< Current parser state */
+    uint8_t header[GZIP_HEADER_LEN]; /*!< Header/trailer accumulation buffer */
+    size_t header_len;             /*!< Bytes accumulated in header[] */
+    size_t skip;                   /*!< Bytes left to skip (extra field, header crc) */
+    tinfl_decompressor inflator;   /*!< ROM inflate state */
+    uint8_t *dict;                 /*!< Sliding window (TINFL_LZ_DICT_SIZE) */
+    size_t dict_offset;            /*!< Current offset in the sliding window */
+    uint32_t crc;                  /*!< CRC32 of decompressed data */
+    size_t output_size;            /*!< Number of decompressed bytes */
+    esp_err_t error;               /*!< First error found in the compressed stream */
+    utils_gzip_output_t output;    /*!< Output callback */
+    void *ctx;                     /*!< Output callback context */
+};
+
+static const char *TAG = "utils_gzip";
+
+bool utils_gzip_is_gzip(const uint8_t *data, size_t len) {
+    return (len >= 2) && (data[0] == GZIP_MAGIC_0) && (data[1] == GZIP_MAGIC_1);
+}
+
+utils_gzip_t *utils_gzip_create(utils_gzip_output_t output, void *ctx) {
+    utils_gzip_t *gzip = calloc(1, sizeof(utils_gzip_t));
+    if (gzip == NULL) {
+        return NULL;
+    }
+    gzip->dict = malloc(TINFL_LZ_DICT_SIZE);
+    if (gzip->dict == NULL) {
+        free(gzip);
+        return NULL;
+    }
+    tinfl_init(&gzip->inflator);
+    gzip->state = GZIP_STATE_HEADER;
+    gzip->output = output;
+    gzip->ctx = ctx;
+    return gzip;
+}
+
+void utils_gzip_destroy(utils_gzip_t *gzip) {
+    if (gzip != NULL) {
+        free(gzip->dict);
+        free(gzip);
+    }
+}
+
+size_t utils_gzip_output_size(const utils_gzip_t *gzip) {
+    return gzip->output_size;
+}
+
+esp_err_t utils_gzip_get_error(const utils_gzip_t *gzip) {
+    return gzip ? gzip->error : ESP_OK;
+}
+
+/* Move to the next optional header field according to flags */
+static void _next_header_state(utils_gzip_t *gzip) {
+    uint8_t flags = gzip->header[3];
+
+    switch (gzip->state) {
+        case GZIP_STATE_HEADER:
+            if (flags & GZIP_FLAG_FEXTRA) {
+                gzip->state = GZIP_STATE_EXTRA_LEN;
+                gzip->header_len = 0;
+                break;
+            }
+            // fall through
+        case GZIP_STATE_EXTRA:
+            if (flags & GZIP_FLAG_FNAME) {
+                gzip->state = GZIP_STATE_NAME;
+                break;
+            }
+            // fall through
+        case GZIP_STATE_NAME:
+            if (flags & GZIP_FLAG_FCOMMENT) {
+                gzip->state = GZIP_STATE_COMMENT;
+                break;
+            }
+            // fall through
+        case GZIP_STATE_COMMENT:
+            if (flags & GZIP_FLAG_FHCRC) {
+                gzip->state = GZIP_STATE_HCRC;
+                gzip->skip = 2;
+                break;
+            }
+            // fall through
+        default:
+            gzip->state = GZIP_STATE_DATA;
+            gzip->header_len = 0;
+            break;
+    }
+}
+
+/* Record an error of the compressed stream itself (not of the output callback) */
+static esp_err_t _stream_error(utils_gzip_t *gzip, esp_err_t err) {
+    if (gzip->error == ESP_OK) {
+        gzip->error = err;
+    }
+    return err;
+}
+
+/* Inflate data and forward output, returns the number of input bytes consumed */
+static esp_err_t _inflate(utils_gzip_t *gzip, const uint8_t *data, size_t len, size_t *consumed) {
+    *consumed = 0;
+    while (true) {
+        size_t in_bytes = len - *consumed;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - gzip->dict_offset;
+        tinfl_status status = tinfl_decompress(&gzip->inflator, data + *consumed, &in_bytes,
+                                               gzip->dict, gzip->dict + gzip->dict_offset, &out_bytes,
+                                               TINFL_FLAG_HAS_MORE_INPUT);
+        *consumed += in_bytes;
+
+        if (out_bytes > 0) {
+            const uint8_t *out = gzip->dict + gzip->dict_offset;
+            gzip->crc = esp_rom_crc32_le(gzip->crc, out, out_bytes);
+            gzip->output_size += out_bytes;
+            gzip->dict_offset = (gzip->dict_offset + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+            esp_err_t err = gzip->output(gzip->ctx, out, out_bytes);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Corrupted deflate stream (%d)", status);
+            return _stream_error(gzip, ESP_ERR_INVALID_RESPONSE);
+        } else if (status == TINFL_STATUS_DONE) {
+            gzip->state = GZIP_STATE_TRAILER;
+            gzip->header_len = 0;
+            return ESP_OK;
+        } else if ((status == TINFL_STATUS_NEEDS_MORE_INPUT) && (*consumed == len)) {
+            return ESP_OK;
+        }
+    }
+}
+
+esp_err_t utils_gzip_write(utils_gzip_t *gzip, const uint8_t *data, size_t len) {
+    size_t offset = 0;
+
+    while (offset < len) {
+        uint8_t byte = data[offset];
+        switch (gzip->state) {
+            case GZIP_STATE_HEADER:
+                gzip->header[gzip->header_len++] = byte;
+                offset++;
+                if (gzip->header_len == GZIP_HEADER_LEN) {
+                    if (!utils_gzip_is_gzip(gzip->header, GZIP_HEADER_LEN) || gzip->header[2] != GZIP_CM_DEFLATE) {
+                        ESP_LOGE(TAG, "Not a gzip (deflate) stream");
+                        return _stream_error(gzip, ESP_ERR_INVALID_RESPONSE);
+                    }
+                    _next_header_state(gzip);
+                }
+                break;
+            case GZIP_STATE_EXTRA_LEN:
+                gzip->skip = (gzip->header_len == 0) ? byte : gzip->skip | (byte << 8);
+                gzip->header_len++;
+                offset++;
+                if (gzip->header_len == 2) {
+                    gzip->state = GZIP_STATE_EXTRA;
+                    if (gzip->skip == 0) {
+                        _next_header_state(gzip);
+                    }
+                }
+                break;
+            case GZIP_STATE_EXTRA:
+            case GZIP_STATE_HCRC: {
+                size_t n = MIN(gzip->skip, len - offset);
+                gzip->skip -= n;
+                offset += n;
+                if (gzip->skip == 0) {
+                    _next_header_state(gzip);
+                }
+                break;
+            }
+            case GZIP_STATE_NAME:
+            case GZIP_STATE_COMMENT:
+                offset++;
+                if (byte == '\0') {
+                    _next_header_state(gzip);
+                }
+                break;
+            case GZIP_STATE_DATA: {
+                size_t consumed;
+                esp_err_t err = _inflate(gzip, data + offset, len - offset, &consumed);
+                if (err != ESP_OK) {
+                    return err;
+                }
+                offset += consumed;
+                break;
+            }
+            case GZIP_STATE_TRAILER: {
+                size_t n = MIN(GZIP_TRAILER_LEN - gzip->header_len, len - offset);
+                memcpy(gzip->header + gzip->header_len, data + offset, n);
+                gzip->header_len += n;
+                offset += n;
+                if (gzip->header_len == GZIP_TRAILER_LEN) {
+                    gzip->state = GZIP_STATE_DONE;
+                }
+                break;
+            }
+            case GZIP_STATE_DONE:
+                // Ignore trailing garbage (e.g. padding)
+                return ESP_OK;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t utils_gzip_finish(utils_gzip_t *gzip) {
+    if (gzip->state != GZIP_STATE_DONE) {
+        ESP_LOGE(TAG, "Truncated gzip stream");
+        return _stream_error(gzip, ESP_ERR_INVALID_SIZE);
+    }
+
+    uint32_t crc = gzip->header[0] | (gzip->header[1] << 8) | (gzip->header[2] << 16) | ((uint32_t) gzip->header[3] << 24);
+    uint32_t isize = gzip->header[4] | (gzip->header[5] << 8) | (gzip->header[6] << 16) | ((uint32_t) gzip->header[7] << 24);
+    if ((crc != gzip->crc) || (isize != (uint32_t) gzip->output_size)) {
+        ESP_LOGE(TAG, "gzip checksum mismatch (crc 0x%08lx/0x%08lx, size %lu/%lu)",
+                 (unsigned long) crc, (unsigned long) gzip->crc, (unsigned long) isize, (unsigned long) gzip->output_size);
+        return _stream_error(gzip, ESP_ERR_INVALID_CRC);
+    }
+    return ESP_OK;
+}
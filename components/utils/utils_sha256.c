@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "utils_sha256.h"
+
+#define FILE_BUFSIZE 1024
+
+static const char *TAG = "utils_sha256";
+
+void utils_sha256_to_hex(const uint8_t *digest, char *hex) {
+    static const char hex_digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < UTILS_SHA256_SIZE; i++) {
+        hex[2*i]     = hex_digits[digest[i] >> 4];
+        hex[2*i + 1] = hex_digits[digest[i] & 0x0f];
+    }
+    hex[2*UTILS_SHA256_SIZE] = '\0';
+}
+
+static int _hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+esp_err_t utils_sha256_from_hex(const char *hex, uint8_t *digest) {
+    if (hex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < UTILS_SHA256_SIZE; i++) {
+        int high = _hex_value(hex[2*i]);
+        int low  = (high < 0) ? -1 : _hex_value(hex[2*i + 1]);
+        if (low < 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        digest[i] = (uint8_t) ((high << 4) | low);
+    }
+    return (hex[2*UTILS_SHA256_SIZE] == '\0') ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t utils_sha256_file(const char *filename, uint8_t *digest, size_t *size) {
+    FILE *fd = fopen(filename, "rb");
+    if (!fd) {
+        ESP_LOGE(TAG, "Unable to open %s", filename);
+        return ESP_FAIL;
+    }
+
+    uint8_t *buffer = malloc(FILE_BUFSIZE);
+    if (buffer == NULL) {
+        fclose(fd);
+        return ESP_ERR_NO_MEM;
+    }
+
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+
+    size_t total = 0;
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, FILE_BUFSIZE, fd)) > 0) {
+        mbedtls_sha256_update(&ctx, buffer, bytes_read);
+        total += bytes_read;
+    }
+    esp_err_t err = ferror(fd) ? ESP_FAIL : ESP_OK;
+
+    mbedtls_sha256_finish(&ctx, digest);
+    mbedtls_sha256_free(&ctx);
+    free(buffer);
+    fclose(fd);
+
+    if (size != NULL) {
+        *size = total;
+    }
+    return err;
+}
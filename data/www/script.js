@@ -39,6 +39,45 @@ function IntToHexString(bytes) {
     return value.toString(16).padStart(4, '0')
 }
 
+// ---------------------------------------------------------------------------
+// Service worker (web asset cache)
+// Note: only available in a secure context (https or localhost)
+// ---------------------------------------------------------------------------
+
+let assetVersion = null;
+
+function registerServiceWorker() {
+    if (!('serviceWorker' in navigator)) {
+        return;
+    }
+    navigator.serviceWorker.addEventListener('message', (event) => {
+        if (event.data.type === 'refreshed') {
+            logToConsole(`Web assets updated (version ${event.data.version}), reloading...`, 'status-message');
+            window.location.reload();
+        } else if (event.data.type === 'refreshFailed') {
+            logToConsole(`Web assets update failed: ${event.data.error}`, 'error-message');
+        }
+    });
+    navigator.serviceWorker.register('sw.js').catch(error => {
+        logToConsole(`Service worker registration failed: ${error}`, 'error-message');
+    });
+    // Version of the assets this page was loaded from (cached copy when controlled)
+    fetch('asset-manifest.json')
+        .then(response => response.json())
+        .then(manifest => { assetVersion = manifest.version; })
+        .catch(() => {});
+}
+
+// Refresh the asset cache when the device reports another version
+function checkAssetVersion(version) {
+    const controller = navigator.serviceWorker ? navigator.serviceWorker.controller : null;
+    if (!version || !assetVersion || version === assetVersion || !controller) {
+        return;
+    }
+    logToConsole(`Web assets version ${version} available (current ${assetVersion}), updating...`, 'status-message');
+    controller.postMessage({ type: 'refresh' });
+}
+
 // ---------------------------------------------------------------------------
 // AYAB code
 // ---------------------------------------------------------------------------
@@ -88,6 +127,63 @@ function handleAyabMessage(message) {
     }
 }
 
+// ---------------------------------------------------------------------------
+// RA4M1 firmware library
+// ---------------------------------------------------------------------------
+function showFirmwareTable(data) {
+    const container = document.getElementById('firmware-table');
+    if (!container) {
+        return;
+    }
+    const images = data.images.sort((a, b) => a.name.localeCompare(b.name));
+    if (images.length === 0) {
+        container.innerHTML = '<p>No image, upload firmware files to /firmware/ (e.g. /firmware/ayab-1.0.bin).</p>';
+        return;
+    }
+    let tableHTML = '<table>';
+    tableHTML += '<thead><tr><th>Name</th><th>Version</th><th>Tag</th><th>Size</th><th></th></tr></thead>';
+    tableHTML += '<tbody>';
+    images.forEach(item => {
+        tableHTML += '<tr>';
+        tableHTML += `<td>${item.active ? '<b>' + item.name + '</b> (active)' : item.name}</td>`;
+        tableHTML += `<td><input type="text" class="firmware-version" data-id="${item.name}" value="${item.version}"></td>`;
+        tableHTML += `<td><input type="text" class="firmware-tag" data-id="${item.name}" value="${item.tag}"></td>`;
+        tableHTML += `<td>${item.sha256 ? item.size : item.size + ' (hashing...)'}</td>`;
+        tableHTML += `<td><button class="firmware-save" data-id="${item.name}">Save</button>`;
+        tableHTML += `<button class="firmware-select" data-id="${item.name}" ${data.busy ? 'disabled' : ''}>Flash</button></td>`;
+        tableHTML += '</tr>';
+    });
+    tableHTML += '</tbody></table>';
+    container.innerHTML = tableHTML;
+    if (data.hashing) {
+        // Refresh once new images are hashed
+        setTimeout(() => sendWebSocketMessage({ id: ws_api.reqListFirmware }), 2000);
+    }
+
+    container.querySelectorAll('.firmware-save').forEach(button => {
+        button.addEventListener('click', () => {
+            const name = button.dataset.id;
+            const version = container.querySelector(`.firmware-version[data-id="${name}"]`).value;
+            const tag = container.querySelector(`.firmware-tag[data-id="${name}"]`).value;
+            sendWebSocketMessage({ id: ws_api.reqTagFirmware, data: { name: name, version: version, tag: tag } });
+        });
+    });
+    container.querySelectorAll('.firmware-select').forEach(button => {
+        button.addEventListener('click', () => {
+            if (confirm(`Flash ${button.dataset.id} to the RA4M1 ?`)) {
+                sendWebSocketMessage({ id: ws_api.reqSelectFirmware, data: { name: button.dataset.id } });
+            }
+        });
+    });
+}
+
+function showFirmwareStatus(text) {
+    const firmwareStatus = document.getElementById('firmware-status');
+    if (firmwareStatus) {
+        firmwareStatus.textContent = text;
+    }
+}
+
 // ---------------------------------------------------------------------------
 // Main code
 // ---------------------------------------------------------------------------
@@ -106,8 +202,12 @@ function handleJSONMessage(data) {
                 <tr><td>Firmware version</td><td>${message.data.esp32_firmware.version}</td></tr>
                 <tr><td>Date</td><td>${message.data.esp32_firmware.compile_date}</td></tr>
                 <tr><td>Time</td><td>${message.data.esp32_firmware.compile_time}</td></tr>
+                <tr><td>Web assets</td><td>${message.data.www ? message.data.www.version : 'unknown'}</td></tr>
                 </tbody></table>
                 `;     
+                if (message.data.www) {
+                    checkAssetVersion(message.data.www.version);
+                }
                 break;
             case ws_api.repGetNetworkParam:
                 for (const key in message.data) {
@@ -135,7 +235,7 @@ function handleJSONMessage(data) {
                 break;
             case ws_api.repListFiles:
                 container = document.getElementById('littlefs-table');
-                fileTable = message.data.list_files;
+                fileTable = message.data.list_files.sort((a, b) => a.name.localeCompare(b.name));
                 if (fileTable.length !== 0) {                  
                     // Add table header
                     let tableHTML = '<table>';
@@ -182,6 +282,32 @@ function handleJSONMessage(data) {
                 sendWebSocketMessage({ id: ws_api.reqListFiles });
                 menuGo("tools");
                 break;                
+            case ws_api.repListFirmware:
+                showFirmwareTable(message.data);
+                break;
+            case ws_api.repSelectFirmware:
+                if (message.result === 0) {
+                    showFirmwareStatus('Flashing started...');
+                } else {
+                    showFirmwareStatus(`Unable to flash image (error=${message.result}).`);
+                }
+                sendWebSocketMessage({ id: ws_api.reqListFirmware });
+                break;
+            case ws_api.repTagFirmware:
+                showFirmwareStatus(message.result === 0 ? 'Image updated.' : `Update failed (error=${message.result}).`);
+                sendWebSocketMessage({ id: ws_api.reqListFirmware });
+                break;
+            case ws_api.indProgress:
+                showDeviceProgress(message.data);
+                if (message.data.target === 'ra4m1_image') {
+                    if (message.data.stage === 'done') {
+                        showFirmwareStatus(message.data.result === 0 ? 'RA4M1 flashed.' : `RA4M1 flashing failed (error=${message.data.result}).`);
+                        sendWebSocketMessage({ id: ws_api.reqListFirmware });
+                    } else if (message.data.total > 0) {
+                        showFirmwareStatus(`Flashing RA4M1: ${((message.data.written / message.data.total) * 100).toFixed(0)}%`);
+                    }
+                }
+                break;
             default:
                 logToConsole(`Unexpected message id received: ${message.id}`, 'error-message');
         }
@@ -332,10 +458,19 @@ document.addEventListener('DOMContentLoaded', () => {
                         <td>Set path on server</td>
                         <td><input type="text" id="littlefsFilepath" style="width:100%;"></td>
                         <td><button type="button" id="littlefsUploadButton">Upload</button></td>
+                    </tr><tr>
+                        <td colspan="2">Extract an archive (.tar, .tar.gz) into the root directory</td>
+                        <td>
+                            <input type="file" id="littlefsArchiveInput" style="display:none;" accept=".tar,.tgz,.gz">
+                            <button type="button" id="littlefsArchiveButton">Upload</button>
+                        </td>
                     </tr><tr>
                     </tr>
                 </tbody></table>
-                <div id="littlefs-table"></div>`,
+                <div id="littlefs-table"></div>
+                <h2>RA4M1 firmware library</h2>
+                <div id="firmware-table"></div>
+                <div id="firmware-status"></div>`,
             sidebar: `
                 <h2>Reset</h2>
                 <button id="resetESP32Button">ESP32</button>
@@ -347,15 +482,19 @@ document.addEventListener('DOMContentLoaded', () => {
                         <form action="/ota">
                             <td>OTA Update</td>
                             <td><select id="binaryType">
-                                <option value="esp32_app" selected>ESP32 App</option>
+                                <option value="esp32_app" selected>ESP32 App (image or delta)</option>
                                 <option value="esp32_littlefs">ESP32 Filesystem</option>
                                 <option value="ra4m1_app">RA4M1 App</option>
+                                <option value="bundle">Bundle (App + Filesystem + RA4M1)</option>
                             </select></td>
                     </tr><tr>
                         <td>Select File</td>
                         <td><button type="button" id="otaButton"/>Upload</button>
-                            <input type="file" id="otaFileInput"  style="display:none;" accept=".bin">
+                            <input type="file" id="otaFileInput"  style="display:none;" accept=".bin,.gz,.delta,.otab">
                         </td>
+                    </tr><tr>
+                        <td>Signature</td>
+                        <td><input type="text" class="form-input" id="otaSignature" placeholder="optional (hex)"></td>
                         </form>
                     </tr>
                 </tbody><tbody id="otaProgressContainer" style="display:none;">
@@ -489,6 +628,7 @@ document.addEventListener('DOMContentLoaded', () => {
             // ---------------------------------------------------------------                
             } else if(contentKey == 'tools') {
                 sendWebSocketMessage({ id: ws_api.reqListFiles });
+                sendWebSocketMessage({ id: ws_api.reqListFirmware });
                 const littlefsFileInput = document.getElementById('littlefsFileInput');
                 littlefsFileInput.addEventListener('change', (event) => {
                     files=event.target.files;
@@ -505,6 +645,16 @@ document.addEventListener('DOMContentLoaded', () => {
                     uploadFile();
                 });
 
+                const littlefsArchiveInput = document.getElementById('littlefsArchiveInput');
+                littlefsArchiveInput.addEventListener('change', (event) => {
+                    uploadArchive(event.target.files);
+                });
+
+                const littlefsArchiveButton = document.getElementById('littlefsArchiveButton');
+                littlefsArchiveButton.addEventListener('click', (event) => {
+                    littlefsArchiveInput.click();
+                });
+
                 const resetESP32Button = document.getElementById('resetESP32Button');
                 resetESP32Button.addEventListener('click', (event) => {
                     sendWebSocketMessage({ id: ws_api.reqESP32Reset });
@@ -561,5 +711,6 @@ document.addEventListener('DOMContentLoaded', () => {
         });
     }
 
+    registerServiceWorker();
     menuGo("home");
 });
\ No newline at end of file
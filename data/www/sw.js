@@ -0,0 +1,59 @@
+// Service worker: precache the web assets listed in asset-manifest.json
+// (generated at build time, see tools/mkmanifest.py) and serve them from
+// the cache, so that reloads only open the WebSocket connection.
+const CACHE_PREFIX = 'ayab-assets-';
+const MANIFEST_URL = 'asset-manifest.json';
+
+// Fetch the current manifest and cache all its assets (including the manifest)
+async function precache() {
+    const response = await fetch(MANIFEST_URL, { cache: 'no-store' });
+    if (!response.ok) {
+        throw new Error(`Failed to fetch ${MANIFEST_URL} (${response.status})`);
+    }
+    const manifest = await response.clone().json();
+    const cacheName = CACHE_PREFIX + manifest.version;
+    if (!(await caches.has(cacheName))) {
+        const cache = await caches.open(cacheName);
+        try {
+            await cache.addAll(manifest.files.map(file => new Request(file, { cache: 'no-store' })));
+            await cache.put(MANIFEST_URL, response);
+        } catch (error) {
+            await caches.delete(cacheName);
+            throw error;
+        }
+    }
+    // Drop outdated versions
+    const names = await caches.keys();
+    await Promise.all(names.filter(name => name.startsWith(CACHE_PREFIX) && name !== cacheName)
+                           .map(name => caches.delete(name)));
+    return manifest.version;
+}
+
+self.addEventListener('install', event => {
+    event.waitUntil(precache().then(() => self.skipWaiting()));
+});
+
+self.addEventListener('activate', event => {
+    event.waitUntil(self.clients.claim());
+});
+
+self.addEventListener('fetch', event => {
+    const request = event.request;
+    if (request.method !== 'GET' || new URL(request.url).origin !== self.location.origin) {
+        return;
+    }
+    // Cache first (ignore query string), network for anything not precached (e.g. uploaded files)
+    event.respondWith(
+        caches.match(request, { ignoreSearch: true }).then(cached => cached || fetch(request))
+    );
+});
+
+// Message { type: 'refresh' } from the page: device reports another asset version
+self.addEventListener('message', event => {
+    if (event.data && event.data.type === 'refresh') {
+        event.waitUntil(precache().then(
+            version => event.source.postMessage({ type: 'refreshed', version: version }),
+            error => event.source.postMessage({ type: 'refreshFailed', error: error.message })
+        ));
+    }
+});
@@ -36,28 +36,184 @@ function uploadFile() {
             }
         };
         xhr.open("POST", upload_path, true);
-        xhr.send(file);
+        // Let the server check file integrity when a digest can be computed
+        // (crypto.subtle is only available in secure contexts)
+        sha256Hex(file).then(digest => {
+            if (digest) {
+                xhr.setRequestHeader("X-Content-SHA256", digest);
+            }
+            xhr.send(file);
+        });
     }
 }
 
-function uploadBinary(fileInput) {
-    const abortButton = document.getElementById("otaAbortButton");
+// Compute SHA-256 (hex) of a file, resolves to null if unsupported
+function sha256Hex(file) {
+    if (!window.crypto || !window.crypto.subtle) {
+        return Promise.resolve(null);
+    }
+    return file.arrayBuffer()
+        .then(buffer => window.crypto.subtle.digest("SHA-256", buffer))
+        .then(hash => Array.from(new Uint8Array(hash)).map(byte => byte.toString(16).padStart(2, '0')).join(''))
+        .catch(() => null);
+}
+
+function uploadArchive(fileInput) {
+    if (fileInput.length == 0) {
+        alert("No file selected!");
+        return;
+    }
+    document.getElementById("littlefsArchiveButton").disabled = true;
+
+    var xhr = new XMLHttpRequest();
+    xhr.onreadystatechange = function() {
+        if (xhr.readyState == 4) {
+            if (xhr.status == 200) {
+                const reply = JSON.parse(xhr.responseText);
+                const failed = reply.files.filter(file => file.result !== 0);
+                reply.files.forEach(file => {
+                    logToConsole(`Archive: ${file.name} (${file.size} bytes) ${file.result === 0 ? 'updated' : `failed (error=${file.result})`}`,
+                        file.result === 0 ? 'status-message' : 'error-message');
+                });
+                if (reply.result !== 0 || failed.length > 0) {
+                    alert(`Archive extraction incomplete (error=${reply.result}, ${failed.length} file(s) failed)`);
+                } else {
+                    alert(`Archive extracted (${reply.files.length} file(s))`);
+                }
+            } else if (xhr.status == 0) {
+                alert("Server closed the connection abruptly!");
+            } else {
+                alert(xhr.status + "Error!\n" + xhr.responseText);
+            }
+            document.getElementById("littlefsArchiveButton").disabled = false;
+            menuGo("tools");
+        }
+    };
+    xhr.open("POST", "/archive/", true);
+    xhr.send(fileInput[0]);
+}
+
+// Progress reported by the device during the current upload
+let deviceProgressSeen = false;
+
+// Show progress reported by the device (OTA update or RA4M1 flashing)
+function showDeviceProgress(progress) {
     const otaProgressContainer = document.getElementById("otaProgressContainer");
-    const progressBar = document.getElementById("otaProgressBar");
     const progressLog = document.getElementById("otaLog");
+    let text;
+
+    if (progress.stage === "done") {
+        text = `${progress.target}: ${progress.result === 0 ? "completed" : `failed (error=${progress.result})`} in ${progress.elapsed.toFixed(1)} s`;
+    } else {
+        text = `${progress.target}: ${progress.stage}`;
+        if (progress.total > 0) {
+            text += ` ${((progress.written / progress.total) * 100).toFixed(0)}%`;
+        }
+        text += ` (${(progress.throughput / 1024).toFixed(1)} KB/s`;
+        if (progress.eta !== undefined) {
+            text += `, ${Math.ceil(progress.eta)} s left`;
+        }
+        text += ")";
+    }
+    // Upload in progress from this page, otherwise report in the console
+    if (progressLog && otaProgressContainer.style.display !== 'none') {
+        deviceProgressSeen = true;
+        progressLog.textContent = text;
+    } else if (progress.stage === "done") {
+        logToConsole(text, 'status-message');
+    }
+}
+
+// Attempts to resume an interrupted OTA upload, and delay between attempts (ms)
+const OTA_RESUME_RETRIES = 5;
+const OTA_RESUME_DELAY = 3000;
+
+function uploadBinary(fileInput) {
+    const otaProgressContainer = document.getElementById("otaProgressContainer");
     const binaryTypeMenu = document.getElementById("binaryType");
     const binaryType = binaryTypeMenu.options[binaryTypeMenu.selectedIndex].value;
+    const headers = {};
 
     var file = fileInput[0];
-    var xhr = new XMLHttpRequest();
 
     otaProgressContainer.style.display ='table-row-group';
+    // Optional signature of the payload SHA-256 (see tools/otasign.py)
+    const signature = document.getElementById("otaSignature").value.trim();
+    if (signature.length > 0) {
+        headers["X-Content-Signature"] = signature;
+    }
+    // Let the device verify the payload before committing it. The digest covers
+    // the uncompressed data, so it is only computed for files not already gzipped.
+    isGzip(file).then(gzipped => Promise.all([gzipped ? null : sha256Hex(file), gzipBlob(file)]))
+        .then(([digest, payload]) => {
+            if (digest) {
+                headers["X-Content-SHA256"] = digest;
+            }
+            if (payload !== file) {
+                logToConsole(`OTA: ${file.name} compressed from ${file.size} to ${payload.size} bytes`, 'status-message');
+            }
+            sendBinary(binaryType, payload, headers, 0, 0);
+        });
+}
+
+// Get the OTA session state, resolves to null if the device is unreachable
+function getOtaStatus() {
+    return fetch("/ota", { cache: "no-store" })
+        .then(response => response.ok ? response.json() : null)
+        .catch(() => null);
+}
+
+// Resume an interrupted upload from the offset reached by the device,
+// resolves to false if there is no session to resume
+function resumeBinary(binaryType, payload, headers, retries) {
+    if (retries >= OTA_RESUME_RETRIES) {
+        return Promise.resolve(false);
+    }
+    return new Promise(resolve => setTimeout(resolve, OTA_RESUME_DELAY))
+        .then(() => getOtaStatus())
+        .then(status => {
+            if (status === null) {
+                // Device not reachable (yet), try again
+                return resumeBinary(binaryType, payload, headers, retries + 1);
+            }
+            if (!status.active || status.binaryType !== binaryType || status.total !== payload.size) {
+                return false;
+            }
+            logToConsole(`OTA: resuming upload at ${status.offset}/${status.total} bytes`, 'status-message');
+            sendBinary(binaryType, payload, headers, status.offset, retries + 1);
+            return true;
+        });
+}
+
+// Upload the payload from the given offset (0 for a new upload)
+function sendBinary(binaryType, payload, headers, offset, retries) {
+    const abortButton = document.getElementById("otaAbortButton");
+    const otaProgressContainer = document.getElementById("otaProgressContainer");
+    const progressBar = document.getElementById("otaProgressBar");
+    const progressLog = document.getElementById("otaLog");
+    let aborted = false;
+
+    var xhr = new XMLHttpRequest();
+
     xhr.onreadystatechange = function() {
         if (xhr.readyState == 4) {
             if (xhr.status == 200) {
                 alert(xhr.responseText);
+            } else if (!aborted && (xhr.status == 0 || xhr.getResponseHeader("X-OTA-Offset") !== null)) {
+                // Connection lost, the device keeps the session for a while
+                progressLog.textContent = "Connection lost, resuming…";
+                resumeBinary(binaryType, payload, headers, retries).then(resumed => {
+                    if (!resumed) {
+                        alert("Server closed the connection abruptly!");
+                        otaProgressContainer.style.display ='none';
+                    }
+                });
+                return;
             } else if (xhr.status == 0) {
                 alert("Server closed the connection abruptly!");
+            } else if (xhr.status == 409) {
+                // Delta patch doesn't match the running firmware
+                alert(xhr.responseText + "\nPlease upload the full firmware image (.bin) instead.");
             } else {
                 alert(xhr.status + "Error!\n" + xhr.responseText);
             }
@@ -66,14 +222,19 @@ function uploadBinary(fileInput) {
     };
     xhr.upload.addEventListener("loadstart", (event) => {
         progressBar.classList.add("visible");
-        progressBar.value = 0;
-        progressBar.max = event.total;
+        progressBar.value = offset;
+        progressBar.max = payload.size;
         abortButton.disabled = false;
-        progressLog.textContent = "Uploading (0%)…";
+        deviceProgressSeen = false;
+        progressLog.textContent = `Uploading (${((offset / payload.size) * 100).toFixed(2)}%)…`;
     });
     xhr.upload.addEventListener("progress", (event) => {
-        progressBar.value = event.loaded;
-        progressLog.textContent = `Uploading (${((event.loaded / event.total) * 100).toFixed(2)}%)…`;
+        progressBar.value = offset + event.loaded;
+        // Prefer the device view (data actually written) when available
+        if (deviceProgressSeen) {
+            return;
+        }
+        progressLog.textContent = `Uploading (${(((offset + event.loaded) / payload.size) * 100).toFixed(2)}%)…`;
     });
     xhr.upload.addEventListener("loadend", (event) => {
         progressBar.classList.remove("visible");
@@ -90,16 +251,40 @@ function uploadBinary(fileInput) {
     xhr.upload.addEventListener("abort", errorAction);
     xhr.upload.addEventListener("timeout", errorAction);
 
-    abortButton.addEventListener("click", () => {xhr.abort();}, { once: true });
+    abortButton.onclick = () => {
+        aborted = true;
+        xhr.abort();
+    };
 
-    xhr.upload.onprogress = function (event) {
-        if (event.lengthComputable) {
-            let progress = Math.round(event.loaded / event.total * 100);
-            progressBar.style.width = progress + "%",
-            progressLog.innerHTML = progress + "%"
-        }
+    xhr.open("POST", `/ota?binaryType=${binaryType}` + (offset > 0 ? `&offset=${offset}` : ""), true);
+    for (const [name, value] of Object.entries(headers)) {
+        xhr.setRequestHeader(name, value);
     }
+    xhr.send(payload.slice(offset));
+}
 
-    xhr.open("POST", `/ota?binaryType=${binaryType}`, true);
-    xhr.send(file);
+// Check gzip magic bytes of a file
+function isGzip(file) {
+    return file.slice(0, 2).arrayBuffer()
+        .then(magic => {
+            const bytes = new Uint8Array(magic);
+            return bytes.length == 2 && bytes[0] == 0x1f && bytes[1] == 0x8b;
+        })
+        .catch(() => false);
+}
+
+// Gzip a file, resolves to the file itself if unsupported, already compressed or not smaller
+function gzipBlob(file) {
+    if (!window.CompressionStream) {
+        return Promise.resolve(file);
+    }
+    return isGzip(file)
+        .then(gzipped => {
+            if (gzipped) {
+                return file;
+            }
+            return new Response(file.stream().pipeThrough(new CompressionStream("gzip"))).blob()
+                .then(compressed => (compressed.size < file.size) ? compressed : file);
+        })
+        .catch(() => file);
 }
\ No newline at end of file
@@ -11,6 +11,13 @@ var ws_api = {
     repListFiles       : 128 + 32,
     reqDeleteFiles     : 33,
     repDeleteFiles     : 128 + 33,
+    reqListFirmware    : 48,
+    repListFirmware    : 128 + 48,
+    reqSelectFirmware  : 49,
+    repSelectFirmware  : 128 + 49,
+    reqTagFirmware     : 50,
+    repTagFirmware     : 128 + 50,
+    indProgress        : 192,
 }
 
 var ws_wifi_params = {
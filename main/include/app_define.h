@@ -14,10 +14,16 @@
 
 #define RA4M1_SAMBA_BAUDRATE 230400
 
+// RA4M1 firmware update (first boot, background task)
+#define APP_RA4M1_FLASH_TASK_STACK    4096
+#define APP_RA4M1_FLASH_TASK_PRIORITY 4
+
 // LITTLEFS
 #define LITTLEFS_BASE_PATH "/littlefs"
 #define DEFAULT_FIRMWARE "firmware.bin"
+#define PREVIOUS_FIRMWARE "ra4m1_previous.bin" // Last healthy RA4M1 image (rollback)
 #define FIRST_BOOT (LITTLEFS_BASE_PATH "/" "firstBoot")
+#define FIRST_BOOT_FORCE "force" // First boot marker content forcing the RA4M1 firmware update
 
 // NVS
 #define NVS_APP_PARTITION "ayab"
@@ -17,7 +17,9 @@
 #include "ra4m1_flash.h"
 #include "srv_littlefs.h"
 #include "srv_http.h"
+#include "srv_index.h"
 #include "srv_mdns.h"
+#include "srv_progress.h"
 #include "srv_websocket.h"
 #include "srv_wifi.h"
 
@@ -79,12 +81,81 @@ BaseType_t ws_rx_bin_callback(const uint8_t *payload, size_t len) {
     return rv;
 }
 
+/**
+ * @brief Callback reporting the progress of RA4M1 firmware flashing.
+ *
+ * @param written Bytes written so far.
+ * @param total Image size in bytes.
+ */
+static void app_ra4m1_flash_progress(size_t written, size_t total) {
+    srv_progress_update(SRV_PROGRESS_STAGE_WRITE, written, written);
+}
+
+/**
+ * @brief Check whether the first boot marker forces the RA4M1 firmware update.
+ *
+ * The firmware image is flashed only when it differs from the one in RA4M1
+ * flash, unless the marker file contains FIRST_BOOT_FORCE.
+ *
+ * @return true if the update is forced.
+ */
+static bool app_first_boot_is_forced() {
+    char content[32] = {0};
+    FILE *fd = fopen(FIRST_BOOT, "r");
+    if (fd) {
+        fread(content, 1, sizeof(content) - 1, fd);
+        fclose(fd);
+    }
+    return strstr(content, FIRST_BOOT_FORCE) != NULL;
+}
+
+/**
+ * @brief Task updating the RA4M1 firmware at first boot.
+ *
+ * Flashing runs in background so that WiFi, mDNS and the HTTP server start
+ * meanwhile; the UART bridge ignores traffic while the RA4M1 is in programming
+ * mode and the progress is broadcast to the web UI. The image is hashed here
+ * too, flashing is skipped when it is already in RA4M1 flash.
+ *
+ * @param pvParameters Unused.
+ */
+static void app_ra4m1_flash_task(void *pvParameters) {
+    struct stat st;
+
+    if (! app_first_boot_is_forced() && ra4m1_flash_image_is_current(LITTLEFS_BASE_PATH "/" DEFAULT_FIRMWARE)) {
+        ESP_LOGI(TAG, "First boot ... RA4M1 firmware unchanged");
+        ra4m1_ctrl_restart();
+    } else {
+        // Update firmware and release reset pin
+        ESP_LOGI(TAG, "First boot ... updating RA4M1 firmware");
+        srv_progress_begin("ra4m1_image", (stat(LITTLEFS_BASE_PATH "/" DEFAULT_FIRMWARE, &st) == 0) ? st.st_size : 0);
+        srv_progress_end(ra4m1_flash_image(LITTLEFS_BASE_PATH "/" DEFAULT_FIRMWARE));
+    }
+    // Remove file even if above fails, i.e. only try once
+    unlink(FIRST_BOOT);
+    srv_index_remove(FIRST_BOOT);
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Keep the RA4M1 backup image when LITTLEFS switches to the updated slot.
+ *
+ * @param base_path Mount point of the updated slot.
+ */
+static void app_littlefs_switch(const char *base_path) {
+    char path[sizeof(SRV_LITTLEFS_NEXT_PATH) + sizeof(PREVIOUS_FIRMWARE)];
+
+    snprintf(path, sizeof(path), "%s/" PREVIOUS_FIRMWARE, base_path);
+    ra4m1_flash_copy_backup(path);
+}
+
 /**
  * @brief Initialize the application setup.
  *
  * This function initializes the event loop, event group, and message queue,
  * sets up the RA4M1 interfaces, initializes NVS, configures LITTLEFS, and
- * attempts to update the RA4M1 firmware at first boot.
+ * starts the update of the RA4M1 firmware at first boot (in background).
  */
 void app_setup() {
     // Create the default event loop
@@ -98,10 +169,15 @@ void app_setup() {
     app_queue_uart_tx = xQueueCreate(APP_QUEUE_UART_TX_SIZE, sizeof(uart_msg_t) );
     ESP_ERROR_CHECK(app_queue_uart_tx != 0 ? ESP_OK : ESP_FAIL);
 
+    // Progress reporting, used by the RA4M1 flash task and the WebSocket handler
+    ESP_ERROR_CHECK(srv_progress_init());
+
     // Setup RA4M1 Interfaces
     ra4m1_ctrl_init(RA4M1_PIN_RESET, RA4M1_PIN_BOOT);
     ra4m1_uart_init(RA4M1_UART, RA4M1_UART_BAUDRATE, RA4M1_UART_TX_PIN, RA4M1_UART_RX_PIN, app_event_group, RA4M1_UART_RX);
     ra4m1_samba_init(RA4M1_UART, RA4M1_SAMBA_BAUDRATE);
+    ra4m1_flash_set_progress_callback(app_ra4m1_flash_progress);
+    ra4m1_flash_set_backup_path(LITTLEFS_BASE_PATH "/" PREVIOUS_FIRMWARE);
 
     // Initialize NVS
     esp_err_t err = nvs_flash_init();
@@ -122,6 +198,7 @@ void app_setup() {
     }; 
 
     // Initialise LITTLEFS file system
+    srv_littlefs_set_switch_callback(app_littlefs_switch);
     srv_littlefs_start(LITTLEFS_BASE_PATH);
 
     // Initialize the networking stack
@@ -130,11 +207,11 @@ void app_setup() {
     // Try to update RA4M1 firmware with a new flash image
     struct stat st;
     if (stat(FIRST_BOOT, &st) == 0) {
-        ESP_LOGI(TAG, "First boot ... updating RA4M1 firmware");
-        // Update firmware and release reset pin      
-        ra4m1_flash_image(LITTLEFS_BASE_PATH "/" DEFAULT_FIRMWARE);
-        // Remove file even if above fails, i.e. only try once
-        unlink(FIRST_BOOT);
+        // Image hashed (and flashed if needed) in background
+        if (xTaskCreate(app_ra4m1_flash_task, "ra4m1_flash_task", APP_RA4M1_FLASH_TASK_STACK, NULL, APP_RA4M1_FLASH_TASK_PRIORITY, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Unable to start RA4M1 firmware update");
+            ra4m1_ctrl_restart();
+        }
     } else {
         ra4m1_ctrl_restart();
     }
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Build a read-only web asset bundle (served by srv_bundle from mapped flash).
+
+Layout (little endian):
+    header  : magic "AYWB", u16 version, u16 count, u32 total size, u32 crc32 (of everything after the header)
+    entries : count x {char name[64], u32 offset, u32 size, u32 flags, u8 digest[8]}, sorted by name
+    data    : file contents (4 bytes aligned), gzip compressed when smaller (flags bit 0)
+"""
+import argparse
+import gzip
+import hashlib
+import os
+import struct
+import zlib
+
+MAGIC = b"AYWB"
+VERSION = 1
+HEADER = struct.Struct("<4sHHII")
+ENTRY = struct.Struct("<64sIII8s")
+FLAG_GZIP = 0x1
+NAME_MAX = 63
+
+
+def collect(root):
+    files = []
+    for dirpath, _, filenames in os.walk(root):
+        for filename in filenames:
+            path = os.path.join(dirpath, filename)
+            name = "/" + os.path.relpath(path, root).replace(os.sep, "/")
+            if len(name.encode()) > NAME_MAX:
+                raise SystemExit(f"mkbundle: name too long: {name}")
+            files.append((name, path))
+    return sorted(files)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="directory to bundle (e.g. data/www)")
+    parser.add_argument("output", help="bundle image")
+    parser.add_argument("--size", type=lambda x: int(x, 0), default=0, help="maximum bundle size (partition size)")
+    parser.add_argument("--no-gzip", action="store_true", help="store files uncompressed")
+    args = parser.parse_args()
+
+    files = collect(args.source)
+    data_offset = HEADER.size + ENTRY.size * len(files)
+    entries = b""
+    data = b""
+    for name, path in files:
+        with open(path, "rb") as f:
+            content = f.read()
+        digest = hashlib.sha256(content).digest()[:8]
+        flags = 0
+        payload = content
+        if not args.no_gzip:
+            compressed = gzip.compress(content, compresslevel=9, mtime=0)
+            if len(compressed) < len(content):
+                payload, flags = compressed, FLAG_GZIP
+        data += b"\0" * (-len(data) % 4)
+        entries += ENTRY.pack(name.encode(), data_offset + len(data), len(payload), flags, digest)
+        data += payload
+
+    body = entries + data
+    total_size = HEADER.size + len(body)
+    if args.size and total_size > args.size:
+        raise SystemExit(f"mkbundle: bundle ({total_size} bytes) larger than partition ({args.size} bytes)")
+    header = HEADER.pack(MAGIC, VERSION, len(files), total_size, zlib.crc32(body) & 0xFFFFFFFF)
+    with open(args.output, "wb") as f:
+        f.write(header + body)
+    print(f"mkbundle: {len(files)} files, {total_size} bytes")
+
+
+if __name__ == "__main__":
+    main()
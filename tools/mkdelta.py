@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Build a delta patch turning an ESP32 application image into another one.
+
+The patch is applied by the device against its running partition while
+streaming (components/ota/ota_delta.c) and can be uploaded as is, or gzip
+compressed (--gzip), with binaryType=esp32_app.
+
+Layout (little endian):
+    header : magic "AYDP", u32 version, u8 base_sha256[32] (app_elf_sha256 of the base image),
+             u8 target_sha256[32] (SHA-256 of the target image), u32 target_size
+    ops    : COPY   (0x01) u32 base_offset, u32 len
+             ADD    (0x02) u32 base_offset, u32 len, u8 diff[len]   (target = base + diff, mod 256)
+             INSERT (0x03) u32 len, u8 data[len]
+             END    (0x00)
+"""
+import argparse
+import gzip
+import hashlib
+import struct
+
+MAGIC = b"AYDP"
+VERSION = 1
+OP_END, OP_COPY, OP_ADD, OP_INSERT = 0, 1, 2, 3
+
+IMAGE_MAGIC = 0xE9
+APP_DESC_OFFSET = 24 + 8          # esp_image_header_t + esp_image_segment_header_t
+APP_DESC_MAGIC = 0xABCD5432
+APP_ELF_SHA256_OFFSET = APP_DESC_OFFSET + 144
+
+BLOCK = 16        # Indexed block size
+MIN_MATCH = 32    # Shorter matches are sent as literal data
+ADD_RATIO = 0.5   # Minimum ratio of equal bytes to send a literal region as ADD
+
+
+def app_elf_sha256(image, name):
+    if len(image) < APP_ELF_SHA256_OFFSET + 32 or image[0] != IMAGE_MAGIC or \
+            struct.unpack_from("<I", image, APP_DESC_OFFSET)[0] != APP_DESC_MAGIC:
+        raise SystemExit(f"mkdelta: {name} is not an ESP32 application image")
+    return image[APP_ELF_SHA256_OFFSET:APP_ELF_SHA256_OFFSET + 32]
+
+
+class Patch:
+    def __init__(self, base):
+        self.base = base
+        self.ops = []
+        self.stats = {OP_COPY: 0, OP_ADD: 0, OP_INSERT: 0}
+
+    def copy(self, offset, length):
+        self.ops.append(struct.pack("<BII", OP_COPY, offset, length))
+        self.stats[OP_COPY] += length
+
+    def literal(self, data, base_offset):
+        """Send data as ADD against base_offset when similar enough, else INSERT"""
+        if not data:
+            return
+        base = self.base[base_offset:base_offset + len(data)]
+        if len(base) == len(data) and sum(a == b for a, b in zip(data, base)) >= ADD_RATIO * len(data):
+            diff = bytes((a - b) & 0xFF for a, b in zip(data, base))
+            self.ops.append(struct.pack("<BII", OP_ADD, base_offset, len(data)) + diff)
+            self.stats[OP_ADD] += len(data)
+        else:
+            self.ops.append(struct.pack("<BI", OP_INSERT, len(data)) + data)
+            self.stats[OP_INSERT] += len(data)
+
+
+def diff(base, target):
+    index = {}
+    for offset in range(0, len(base) - BLOCK + 1, 4):
+        index.setdefault(base[offset:offset + BLOCK], offset)
+
+    patch = Patch(base)
+    literal_start = 0
+    base_next = 0     # Base offset following the last copy (same shift)
+    pos = 0
+    while pos <= len(target) - BLOCK:
+        offset = index.get(target[pos:pos + BLOCK])
+        if offset is None:
+            pos += 1
+            continue
+        # Extend match forward and backward (within the pending literal)
+        length = BLOCK
+        while pos + length < len(target) and offset + length < len(base) and \
+                target[pos + length] == base[offset + length]:
+            length += 1
+        back = 0
+        while pos - back > literal_start and offset - back > 0 and \
+                target[pos - back - 1] == base[offset - back - 1]:
+            back += 1
+        if length + back < MIN_MATCH:
+            pos += 1
+            continue
+        pos -= back
+        offset -= back
+        length += back
+        patch.literal(target[literal_start:pos], base_next)
+        patch.copy(offset, length)
+        pos += length
+        literal_start = pos
+        base_next = offset + length
+    patch.literal(target[literal_start:], base_next)
+    return patch
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("base", help="application image running on the device (.bin)")
+    parser.add_argument("target", help="new application image (.bin)")
+    parser.add_argument("output", help="delta patch")
+    parser.add_argument("--gzip", action="store_true", help="gzip compress the patch")
+    args = parser.parse_args()
+
+    with open(args.base, "rb") as f:
+        base = f.read()
+    with open(args.target, "rb") as f:
+        target = f.read()
+    base_sha256 = app_elf_sha256(base, args.base)
+    app_elf_sha256(target, args.target)
+
+    patch = diff(base, target)
+    data = MAGIC + struct.pack("<I", VERSION) + base_sha256 + hashlib.sha256(target).digest() + \
+        struct.pack("<I", len(target)) + b"".join(patch.ops) + bytes([OP_END])
+    if args.gzip:
+        data = gzip.compress(data, compresslevel=9, mtime=0)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print(f"mkdelta: {len(target)} bytes image, {len(data)} bytes patch "
+          f"(copy {patch.stats[OP_COPY]}, add {patch.stats[OP_ADD]}, insert {patch.stats[OP_INSERT]})")
+
+
+if __name__ == "__main__":
+    main()
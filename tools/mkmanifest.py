@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""Stage the LittleFS data directory and generate the web asset manifest.
+
+The data directory is copied to the staging directory and
+<www>/asset-manifest.json is generated with the list of assets precached by
+the service worker (sw.js) and a version derived from their content:
+
+    {"version": "<first 16 hex digits of sha256>", "files": ["/", "/index.htm", ...]}
+"""
+import argparse
+import hashlib
+import json
+import os
+import shutil
+
+MANIFEST = "asset-manifest.json"
+SERVICE_WORKER = "sw.js"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="data directory (e.g. data)")
+    parser.add_argument("staging", help="staging directory used to build the LittleFS image")
+    parser.add_argument("--www", default="www", help="web assets directory, relative to source")
+    args = parser.parse_args()
+
+    shutil.rmtree(args.staging, ignore_errors=True)
+    shutil.copytree(args.source, args.staging)
+
+    www = os.path.join(args.staging, args.www)
+    version = hashlib.sha256()
+    files = []
+    for dirpath, _, filenames in os.walk(www):
+        for filename in filenames:
+            path = os.path.join(dirpath, filename)
+            name = "/" + os.path.relpath(path, www).replace(os.sep, "/")
+            if name in ("/" + MANIFEST, "/" + SERVICE_WORKER):
+                # The service worker is updated by the browser itself
+                continue
+            files.append((name, path))
+
+    for name, path in sorted(files):
+        with open(path, "rb") as f:
+            version.update(name.encode() + b"\0" + hashlib.sha256(f.read()).digest())
+
+    manifest = {
+        "version": version.hexdigest()[:16],
+        "files": ["/"] + [name for name, _ in sorted(files)],
+    }
+    with open(os.path.join(www, MANIFEST), "w") as f:
+        json.dump(manifest, f, separators=(",", ":"))
+    print(f"mkmanifest: version {manifest['version']}, {len(files)} files")
+
+
+if __name__ == "__main__":
+    main()
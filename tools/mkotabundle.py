@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""Build a multi-target OTA bundle (ESP32 app, LittleFS image and/or RA4M1 firmware).
+
+The bundle is uploaded once with binaryType=bundle. The device streams each
+image to its target (components/ota/ota_bundle.c), checks it and commits all of
+them at the end (a failure rolls back the images already written), then
+restarts once if the ESP32 application was updated.
+
+Layout (little endian):
+    header : magic "AYOB", u16 version, u16 count
+    entries: char name[16] (binaryType), u32 size (stored), u32 image_size,
+             u32 flags (bit 0: gzip), u8 sha256[32] (SHA-256 of the image)
+    data   : images in entry order (esp32_app, esp32_littlefs, ra4m1_app)
+"""
+import argparse
+import gzip
+import hashlib
+import struct
+
+MAGIC = b"AYOB"
+VERSION = 1
+FLAG_GZIP = 0x01
+TARGETS = ("esp32_app", "esp32_littlefs", "ra4m1_app")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--app", help="ESP32 application image (.bin) or delta patch")
+    parser.add_argument("--littlefs", help="LittleFS partition image (.bin)")
+    parser.add_argument("--ra4m1", help="RA4M1 firmware (.bin)")
+    parser.add_argument("--gzip", action="store_true", help="gzip compress images (when smaller)")
+    parser.add_argument("output", help="OTA bundle")
+    args = parser.parse_args()
+
+    images = [(name, path) for name, path in zip(TARGETS, (args.app, args.littlefs, args.ra4m1)) if path]
+    if not images:
+        raise SystemExit("mkotabundle: no image given")
+
+    entries = b""
+    data = b""
+    for name, path in images:
+        with open(path, "rb") as f:
+            image = f.read()
+        stored, flags = image, 0
+        if args.gzip and image[:2] != b"\x1f\x8b":
+            compressed = gzip.compress(image, compresslevel=9, mtime=0)
+            if len(compressed) < len(image):
+                stored, flags = compressed, FLAG_GZIP
+        entries += struct.pack("<16sIII32s", name.encode(), len(stored), len(image), flags,
+                               hashlib.sha256(image).digest())
+        data += stored
+        print(f"mkotabundle: {name}: {len(image)} bytes{f' ({len(stored)} compressed)' if flags else ''}")
+
+    bundle = MAGIC + struct.pack("<HH", VERSION, len(images)) + entries + data
+    with open(args.output, "wb") as f:
+        f.write(bundle)
+    print(f"mkotabundle: {len(bundle)} bytes bundle, SHA-256 {hashlib.sha256(bundle).hexdigest()}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""Sign OTA payloads (CONFIG_OTA_SIGNATURE_VERIFY).
+
+    otasign.py keygen private.pem           create a key pair, print the public key for
+                                            CONFIG_OTA_SIGNATURE_PUBLIC_KEY
+    otasign.py sign private.pem firmware    print the payload SHA-256 and its Ed25519
+                                            signature, and write them to <firmware>.sig
+
+The digest covers the data written to the OTA target: gzip compressed payloads
+are hashed after decompression. Supply the values with the X-Content-SHA256 and
+X-Content-Signature headers, or the sha256 and signature query parameters.
+"""
+import argparse
+import gzip
+import hashlib
+
+from cryptography.hazmat.primitives import serialization
+from cryptography.hazmat.primitives.asymmetric.ed25519 import Ed25519PrivateKey
+
+
+def public_key_hex(private_key):
+    return private_key.public_key().public_bytes(
+        encoding=serialization.Encoding.Raw, format=serialization.PublicFormat.Raw).hex()
+
+
+def keygen(args):
+    private_key = Ed25519PrivateKey.generate()
+    with open(args.key, "wb") as f:
+        f.write(private_key.private_bytes(encoding=serialization.Encoding.PEM,
+                                          format=serialization.PrivateFormat.PKCS8,
+                                          encryption_algorithm=serialization.NoEncryption()))
+    print(f"CONFIG_OTA_SIGNATURE_PUBLIC_KEY=\"{public_key_hex(private_key)}\"")
+
+
+def sign(args):
+    with open(args.key, "rb") as f:
+        private_key = serialization.load_pem_private_key(f.read(), password=None)
+    with open(args.payload, "rb") as f:
+        payload = f.read()
+    if payload[:2] == b"\x1f\x8b":
+        payload = gzip.decompress(payload)
+    digest = hashlib.sha256(payload).digest()
+    signature = private_key.sign(digest)
+    with open(args.payload + ".sig", "w") as f:
+        f.write(f"sha256={digest.hex()}\nsignature={signature.hex()}\n")
+    print(f"sha256={digest.hex()}")
+    print(f"signature={signature.hex()}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    subparsers = parser.add_subparsers(dest="command", required=True)
+    parser_keygen = subparsers.add_parser("keygen", help="create a key pair")
+    parser_keygen.add_argument("key", help="private key (PEM) to create")
+    parser_keygen.set_defaults(func=keygen)
+    parser_sign = subparsers.add_parser("sign", help="sign an OTA payload")
+    parser_sign.add_argument("key", help="private key (PEM)")
+    parser_sign.add_argument("payload", help="OTA payload (app image, delta patch, LittleFS image, RA4M1 firmware)")
+    parser_sign.set_defaults(func=sign)
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()